@@ -0,0 +1,1616 @@
+#include "rtutils.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "quad.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "triangle_mesh.h"
+#include "wide_bvh.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+template <typename Draw>
+double draws_per_second(int threads, long draws_per_thread, Draw draw) {
+    // Runs draw() draws_per_thread times on each of the given number of threads at once.
+    std::vector<std::thread> workers;
+    std::vector<double> sinks(threads, 0.0);
+
+    auto start = bench_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            double sum = 0;
+            for (long i = 0; i < draws_per_thread; i++)
+                sum += draw();
+            sinks[t] = sum; // Keep the loop from being optimized away
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+
+    return threads * double(draws_per_thread) / seconds_since(start);
+}
+
+void bench_random(const std::vector<int>& thread_counts) {
+    std::cout << "\n== random_double: draws/s (millions) ==\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "std::rand"
+              << std::setw(14) << "thread_rng" << std::setw(10) << "speedup" << '\n';
+
+    const long draws = 4'000'000;
+    for (auto threads : thread_counts) {
+        auto legacy = draws_per_second(threads, draws, [] {
+            return std::rand() / (RAND_MAX + 1.0);
+        });
+        auto current = draws_per_second(threads, draws, [] { return random_double(); });
+
+        std::cout << std::setw(8) << threads
+                  << std::setw(14) << legacy / 1e6
+                  << std::setw(14) << current / 1e6
+                  << std::setw(10) << current / legacy << '\n';
+    }
+}
+
+hittable_list bench_spheres() {
+    // A fixed-seed version of the bouncing spheres scene, without texture or motion blur.
+    seed_random(1);
+
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(.5,.5,.5))));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            auto albedo = color::random() * color::random();
+            world.add(make_shared<sphere>(center, 0.2, make_shared<lambertian>(albedo)));
+        }
+    }
+
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<metal>(color(.7,.6,.5), 0.0)));
+
+    return hittable_list(make_shared<bvh_node>(world));
+}
+
+void bench_render(const std::vector<int>& thread_counts) {
+    std::cout << "\n== camera::render_samples: samples/s ==\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "samples/s" << '\n';
+
+    auto world = bench_spheres();
+
+    for (auto threads : thread_counts) {
+        camera cam;
+
+        cam.aspect_ratio      = 16.0 / 9.0;
+        cam.image_width       = 160;
+        cam.samples_per_pixel = 16;
+        cam.max_depth         = 10;
+        cam.background        = color(0.70, 0.80, 1.00);
+
+        cam.vfov     = 20;
+        cam.lookfrom = point3(13,2,3);
+        cam.lookat   = point3(0,0,0);
+
+        cam.number_of_threads = threads;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        cam.render_samples(world);
+
+        auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+        std::cout << std::setw(8) << threads
+                  << std::setw(14) << samples / cam.last_render_time() << '\n';
+    }
+}
+
+void bench_scene_scaling(const std::vector<int>& thread_counts) {
+    // final_scene shades its ground and sphere cluster materials from every thread at once,
+    // which is where shared state in the hit path shows up as lost scaling.
+    std::cout << "\n== final_scene render: samples/s by thread count ==\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "samples/s" << std::setw(10) << "speedup"
+              << '\n';
+
+    seed_random(9);
+    auto s = final_scene(200, 16, 8);
+    double single = 0;
+
+    for (auto threads : thread_counts) {
+        camera cam = s.cam;
+        cam.number_of_threads = threads;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        cam.render_samples(s.world);
+
+        auto rate = double(cam.image_width) * cam.height() * cam.samples_per_pixel / cam.last_render_time();
+        if (single == 0)
+            single = rate;
+        std::cout << std::setw(8) << threads << std::setw(14) << rate << std::setw(10) << rate / single << '\n';
+    }
+}
+
+std::vector<ray> random_rays_into(const aabb& bbox, int count) {
+    // Rays from random points on a sphere around the box towards random points inside it.
+    auto center = bvh_tree::centroid(bbox);
+    auto radius = 0.5 * point3(bbox.x.size(), bbox.y.size(), bbox.z.size()).length();
+
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto origin = center + 2 * radius * random_unit_vector();
+        auto target = point3(
+            random_double(bbox.x.min, bbox.x.max),
+            random_double(bbox.y.min, bbox.y.max),
+            random_double(bbox.z.min, bbox.z.max)
+        );
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+struct traversal_result {
+    double mrays_per_second;
+    long   hits;
+};
+
+traversal_result trace_rays(const hittable& world, const std::vector<ray>& rays) {
+    hit_record rec;
+    long hits = 0;
+
+    auto start = bench_clock::now();
+    for (const auto& r : rays) {
+        if (world.hit(r, interval(0.001, infinity), rec))
+            hits++;
+    }
+    auto seconds = seconds_since(start);
+
+    return {rays.size() / seconds / 1e6, hits};
+}
+
+hittable_list final_scene_boxes1() {
+    // The ground boxes of final_scene: 400 boxes of six quads each.
+    seed_random(2);
+
+    hittable_list boxes1;
+    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y1 = random_double(1,101);
+
+            boxes1.add(box(point3(x0, 0, z0), point3(x0 + w, y1, z0 + w), ground));
+        }
+    }
+    return boxes1;
+}
+
+hittable_list final_scene_boxes2() {
+    // The cluster of 1000 spheres of final_scene.
+    seed_random(3);
+
+    hittable_list boxes2;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int j = 0; j < 1000; j++)
+        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+    return boxes2;
+}
+
+std::string nodes_per_ray(size_t rays) {
+    // BVH nodes this thread visited per ray since the counter was cleared, from the RT_STATS
+    // counters; "-" in a build without them.
+    if (!render_stats_enabled)
+        return "-";
+    std::ostringstream out;
+    out << double(thread_counters().bvh_nodes_visited) / rays;
+    return out.str();
+}
+
+void bench_bvh_layout(const char* name, const hittable_list& list) {
+    bvh_node   tree(list);
+    linear_bvh flat(list);
+    bvh4       wide4(list);
+    bvh8       wide8(list);
+
+    seed_random(4);
+    auto rays = random_rays_into(list.bounding_box(), 500'000);
+
+    auto row = [&](const char* layout, const hittable& world, size_t nodes, size_t bytes) {
+        thread_counters().bvh_nodes_visited = 0;
+        auto result = trace_rays(world, rays);
+
+        std::cout << std::setw(8) << name
+                  << std::setw(10) << layout
+                  << std::setw(10) << result.mrays_per_second
+                  << std::setw(10) << result.hits
+                  << std::setw(10) << nodes
+                  << std::setw(12) << bytes
+                  << std::setw(12) << nodes_per_ray(rays.size()) << '\n';
+    };
+
+    // bvh_node allocates one node per split, plus a shared_ptr control block each. It does not
+    // count its node visits.
+    auto tree_nodes = list.objects.size() - 1;
+    row("bvh_node", tree, tree_nodes, tree_nodes * (sizeof(bvh_node) + 2 * sizeof(void*)));
+    row("linear", flat, flat.node_count(), flat.memory_bytes());
+    row("bvh4", wide4, wide4.node_count(), wide4.memory_bytes());
+    row("bvh8", wide8, wide8.node_count(), wide8.memory_bytes());
+
+    std::cout << "          ";
+    wide4.print_layout(std::cout);
+    std::cout << "          ";
+    wide8.print_layout(std::cout);
+}
+
+hittable_list random_spheres(int count) {
+    // Small spheres scattered through a cube, sharing one material.
+    seed_random(8);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    hittable_list spheres;
+    for (int i = 0; i < count; i++) {
+        auto center = point3(random_double(0, 100), random_double(0, 100), random_double(0, 100));
+        spheres.add(make_shared<sphere>(center, random_double(0.1, 0.5), mat));
+    }
+    return spheres;
+}
+
+void bench_bvh_layouts() {
+    std::cout << "\n== BVH layout: closest-hit traversal ==\n";
+    std::cout << std::setw(8) << "scene" << std::setw(10) << "layout" << std::setw(10) << "Mrays/s"
+              << std::setw(10) << "hits" << std::setw(10) << "nodes" << std::setw(12) << "bytes"
+              << std::setw(12) << "nodes/ray" << '\n';
+
+    bench_bvh_layout("boxes1", final_scene_boxes1());
+    bench_bvh_layout("boxes2", final_scene_boxes2());
+    bench_bvh_layout("100k", random_spheres(100'000));
+}
+
+std::vector<ray> primary_rays(const camera& cam, int width) {
+    // One pinhole ray through the center of every pixel of the scene's camera view.
+    auto height = std::max(1, int(width / cam.aspect_ratio));
+    auto h = std::tan(degrees_to_radians(cam.vfov) / 2);
+    auto viewport_height = 2 * h;
+    auto viewport_width = viewport_height * double(width) / height;
+
+    auto w = unit_vector(cam.lookfrom - cam.lookat);
+    auto u = unit_vector(cross(cam.vup, w));
+    auto v = cross(w, u);
+
+    std::vector<ray> rays;
+    rays.reserve(width * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            auto s = ((i + 0.5) / width - 0.5) * viewport_width;
+            auto t = (0.5 - (j + 0.5) / height) * viewport_height;
+            rays.push_back(ray(cam.lookfrom, s*u + t*v - w, 0.5));
+        }
+    }
+    return rays;
+}
+
+void bench_bvh_builders() {
+    std::cout << "\n== BVH builders: median split vs binned SAH, all scenes ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(8) << "split"
+              << std::setw(10) << "prims" << std::setw(10) << "nodes" << std::setw(10) << "SAH"
+              << std::setw(12) << "build ms" << std::setw(12) << "nodes/ray"
+              << std::setw(10) << "Mrays/s" << '\n';
+
+    using scene_builder = std::function<scene(const bvh_build_options&)>;
+    std::vector<std::pair<const char*, scene_builder>> scenes = {
+        {"bouncing_spheres",  [](const bvh_build_options& o) { return bouncing_spheres(o); }},
+        {"checkered_spheres", [](const bvh_build_options&)   { return checkered_spheres(); }},
+        {"earth",             [](const bvh_build_options&)   { return earth(); }},
+        {"perlin_spheres",    [](const bvh_build_options&)   { return perlin_spheres(); }},
+        {"quads",             [](const bvh_build_options&)   { return quads(); }},
+        {"simple_light",      [](const bvh_build_options&)   { return simple_light(); }},
+        {"cornell_box",       [](const bvh_build_options&)   { return cornell_box(); }},
+        {"cornell_smoke",     [](const bvh_build_options&)   { return cornell_smoke(); }},
+        {"final_scene",       [](const bvh_build_options& o) { return final_scene(400, 256, 4, o); }},
+    };
+
+    for (const auto& [name, build_scene] : scenes) {
+        for (auto split : {bvh_split_method::median, bvh_split_method::sah}) {
+            bvh_build_options options;
+            options.split = split;
+
+            // Every scene is wrapped in a top-level BVH, so that scenes without one of their own
+            // are compared as well. Nested BVHs are built with the same options. The build time
+            // covers the whole scene, which only differs between the two splits in its BVHs.
+            seed_random(5);
+            auto start = bench_clock::now();
+            auto s = build_scene(options);
+            linear_bvh world(s.world, options);
+            auto build_seconds = seconds_since(start);
+
+            auto rays = primary_rays(s.cam, 200);
+            thread_counters().bvh_nodes_visited = 0;
+            auto result = trace_rays(world, rays);
+
+            const auto& report = world.build_report();
+            std::cout << std::setw(18) << name
+                      << std::setw(8) << (split == bvh_split_method::sah ? "sah" : "median")
+                      << std::setw(10) << report.primitives
+                      << std::setw(10) << report.nodes
+                      << std::setw(10) << report.sah_cost
+                      << std::setw(12) << 1000 * build_seconds
+                      << std::setw(12) << nodes_per_ray(rays.size())
+                      << std::setw(10) << result.mrays_per_second << '\n';
+        }
+    }
+}
+
+traversal_result trace_packets(const hittable& world, const std::vector<ray>& rays, int width,
+                               int block_width, int block_height) {
+    // Traces the rays of a width wide image of primary rays in packets of neighboring pixels,
+    // block_width x block_height at a time.
+    auto height = int(rays.size()) / width;
+    ray_packet packet;
+    packet_hits hits;
+    long hit_count = 0;
+
+    auto start = bench_clock::now();
+    for (int y = 0; y < height; y += block_height) {
+        for (int x = 0; x < width; x += block_width) {
+            packet.size = 0;
+            for (int j = y; j < std::min(y + block_height, height); j++)
+                for (int i = x; i < std::min(x + block_width, width); i++)
+                    packet.set(packet.size++, rays[i + j*width], interval(0.001, infinity));
+
+            auto hit_mask = world.hit_packet(packet, packet.all(), hits);
+            hit_count += lane_count(hit_mask);
+        }
+    }
+    auto seconds = seconds_since(start);
+
+    return {rays.size() / seconds / 1e6, hit_count};
+}
+
+bool legacy_box_hit(const aabb& box, const ray& r, interval ray_t) {
+    // aabb::hit as it was before rays cached their inverse direction: a division per axis and
+    // a branch on the order of the two slab distances.
+    const point3& ray_orig = r.origin();
+    const vec3&   ray_dir  = r.direction();
+
+    for (int axis = 0;  axis < 3; axis++) {
+        const interval& ax = box.axis_interval(axis);
+        const double adinv = 1.0 / ray_dir[axis];
+
+        auto t0 = (ax.min - ray_orig[axis])  * adinv;
+        auto t1 = (ax.max - ray_orig[axis])  * adinv;
+
+        if (t0 < t1) {
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+        } else {
+            if (t1 > ray_t.min) ray_t.min = t1;
+            if (t0 < ray_t.max) ray_t.max = t0;
+        }
+
+        if (ray_t.max <= ray_t.min)
+            return false;
+    }
+    return true;
+}
+
+void bench_box_tests() {
+    std::cout << "\n== aabb::hit: box tests/s ==\n";
+    std::cout << std::setw(10) << "slab" << std::setw(14) << "Mtests/s" << std::setw(12) << "hits" << '\n';
+
+    // Small random boxes inside a unit cube, and random rays through the cube.
+    seed_random(3);
+    auto scene_box = aabb(point3(0,0,0), point3(1,1,1));
+    std::vector<aabb> boxes;
+    for (int i = 0; i < 1024; i++) {
+        auto p = point3(random_double(), random_double(), random_double());
+        boxes.push_back(aabb(p, p + 0.2 * vec3(random_double(), random_double(), random_double())));
+    }
+    auto rays = random_rays_into(scene_box, 4096);
+
+    auto run = [&](const char* name, auto box_hit) {
+        long hits = 0;
+        auto start = bench_clock::now();
+        for (const auto& r : rays)
+            for (const auto& box : boxes)
+                hits += box_hit(box, r, interval(0.001, infinity));
+        auto seconds = seconds_since(start);
+
+        std::cout << std::setw(10) << name
+                  << std::setw(14) << double(rays.size()) * boxes.size() / seconds / 1e6
+                  << std::setw(12) << hits << '\n';
+    };
+
+    run("legacy", [](const aabb& box, const ray& r, interval t) { return legacy_box_hit(box, r, t); });
+    run("aabb::hit", [](const aabb& box, const ray& r, interval t) { return box.hit(r, t); });
+}
+
+void bench_sphere_batch_set(const char* name, const std::vector<std::pair<point3, double>>& spheres) {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    hittable_list list;
+    sphere_batch batch;
+    for (const auto& [center, radius] : spheres) {
+        list.add(make_shared<sphere>(center, radius, mat));
+        batch.add(center, radius, mat);
+    }
+
+    auto build_start = bench_clock::now();
+    linear_bvh objects(list);
+    auto objects_build = seconds_since(build_start);
+
+    build_start = bench_clock::now();
+    batch.build();
+    auto batch_build = seconds_since(build_start);
+
+    seed_random(4);
+    auto rays = random_rays_into(list.bounding_box(), 500'000);
+
+    // Both must find the same closest hits.
+    long mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i += 97) {
+        hit_record a, b;
+        auto hit_a = objects.hit(rays[i], interval(0.001, infinity), a);
+        auto hit_b = batch.hit(rays[i], interval(0.001, infinity), b);
+        if (hit_a != hit_b || (hit_a && (std::fabs(a.t - b.t) > 1e-9 || std::fabs(a.u - b.u) > 1e-9)))
+            mismatches++;
+    }
+
+    auto objects_result = trace_rays(objects, rays);
+    auto batch_result = trace_rays(batch, rays);
+
+    // A sphere object: the object itself and make_shared's control block, the shared_ptrs in
+    // the list and in linear_bvh, plus linear_bvh's own arrays.
+    auto n = double(spheres.size());
+    auto object_bytes = (sizeof(sphere) + 2 * sizeof(void*) + 2 * sizeof(shared_ptr<hittable>))
+                      + objects.memory_bytes() / n;
+
+    auto row = [&](const char* layout, const traversal_result& result, double bytes, double build) {
+        std::cout << std::setw(8) << name << std::setw(14) << layout
+                  << std::setw(10) << result.mrays_per_second
+                  << std::setw(10) << result.hits
+                  << std::setw(14) << bytes
+                  << std::setw(12) << 1000 * build << '\n';
+    };
+    row("sphere+linear", objects_result, object_bytes, objects_build);
+    row("sphere_batch", batch_result, batch.memory_bytes() / n, batch_build);
+    if (mismatches)
+        std::cout << "  " << mismatches << " differing hits\n";
+}
+
+void bench_sphere_batch() {
+    std::cout << "\n== sphere objects in linear_bvh vs sphere_batch: closest-hit traversal ==\n";
+    std::cout << std::setw(8) << "spheres" << std::setw(14) << "layout" << std::setw(10) << "Mrays/s"
+              << std::setw(10) << "hits" << std::setw(14) << "bytes/sphere"
+              << std::setw(12) << "build ms" << '\n';
+
+    // The cluster of final_scene, and a large set of small spheres.
+    std::vector<std::pair<point3, double>> cluster, scattered;
+    seed_random(3);
+    for (int i = 0; i < 1000; i++)
+        cluster.push_back({point3::random(0, 165), 10});
+    seed_random(8);
+    for (int i = 0; i < 100'000; i++)
+        scattered.push_back({point3::random(0, 100), random_double(0.1, 0.5)});
+
+    bench_sphere_batch_set("1k", cluster);
+    bench_sphere_batch_set("100k", scattered);
+}
+
+bool write_torus_obj(const std::string& path, int rings, int sides, double major, double minor) {
+    // A closed torus of 2 * rings * sides triangles, with normals and texture coordinates.
+    // Returns false if the file cannot be written.
+    auto file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    std::fprintf(file, "# torus %d x %d\n", rings, sides);
+    for (int i = 0; i < rings; i++) {
+        auto u = 2 * pi * i / rings;
+        for (int j = 0; j < sides; j++) {
+            auto v = 2 * pi * j / sides;
+            auto n = vec3(std::cos(u) * std::cos(v), std::sin(v), std::sin(u) * std::cos(v));
+            auto p = point3(major * std::cos(u), 0, major * std::sin(u)) + minor * n;
+            std::fprintf(file, "v %.7f %.7f %.7f\nvn %.5f %.5f %.5f\nvt %.5f %.5f\n",
+                         p.x(), p.y(), p.z(), n.x(), n.y(), n.z(), double(i) / rings, double(j) / sides);
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            int a = i * sides + j + 1;
+            int b = (i + 1) % rings * sides + j + 1;
+            int c = (i + 1) % rings * sides + (j + 1) % sides + 1;
+            int d = i * sides + (j + 1) % sides + 1;
+            std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, d, d, d, c, c, c, b, b, b);
+        }
+    }
+    return std::fclose(file) == 0;
+}
+
+bool naive_load_obj(const std::string& path, triangle_mesh& mesh) {
+    // The obvious loader, for comparison: a std::string and a stringstream per line.
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        std::string keyword;
+        in >> keyword;
+        if (keyword == "v") {
+            double x, y, z;
+            in >> x >> y >> z;
+            mesh.positions.emplace_back(x, y, z);
+        } else if (keyword == "vn") {
+            double x, y, z;
+            in >> x >> y >> z;
+            mesh.normals.emplace_back(x, y, z);
+        } else if (keyword == "vt") {
+            double u, v;
+            in >> u >> v;
+            mesh.uvs.push_back({u, v});
+        } else if (keyword == "f") {
+            std::vector<std::array<uint32_t, 3>> corners;
+            std::string corner;
+            while (in >> corner) {
+                std::array<uint32_t, 3> c = {0, 0, 0};
+                std::istringstream parts(corner);
+                std::string part;
+                for (int k = 0; k < 3 && std::getline(parts, part, '/'); k++)
+                    c[k] = part.empty() ? 0 : uint32_t(std::stoul(part) - 1);
+                corners.push_back(c);
+            }
+            for (size_t k = 2; k < corners.size(); k++) {
+                for (auto corner_index : {size_t(0), k - 1, k}) {
+                    mesh.position_indices.push_back(corners[corner_index][0]);
+                    mesh.uv_indices.push_back(corners[corner_index][1]);
+                    mesh.normal_indices.push_back(corners[corner_index][2]);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void bench_triangle_mesh() {
+    std::cout << "\n== triangle_mesh: OBJ load, build and traversal of a generated torus ==\n";
+
+    const int rings = 1024, sides = 1024;
+    const double major = 3, minor = 1;
+    auto path = (std::filesystem::temp_directory_path() / "rt_bench_torus.obj").string();
+    if (!write_torus_obj(path, rings, sides, major, minor)) {
+        std::cout << "  skipped: could not write " << path << '\n';
+        return;
+    }
+    auto file_bytes = double(std::filesystem::file_size(path));
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    std::cout << std::setw(16) << "loader" << std::setw(12) << "seconds" << std::setw(10) << "MB/s"
+              << std::setw(12) << "Mtris/s" << '\n';
+    auto load_row = [&](const char* name, double seconds, size_t triangles) {
+        std::cout << std::setw(16) << name << std::setw(12) << seconds
+                  << std::setw(10) << file_bytes / seconds / 1e6
+                  << std::setw(12) << triangles / seconds / 1e6 << '\n';
+    };
+
+    {
+        triangle_mesh naive(mat);
+        auto start = bench_clock::now();
+        naive_load_obj(path, naive);
+        load_row("getline+stream", seconds_since(start), naive.triangle_count());
+    }
+
+    triangle_mesh mesh(mat);
+    obj_load_report load;
+    if (!load_obj(path, mesh, &load)) {
+        std::filesystem::remove(path);
+        return;
+    }
+    load_row("obj_loader", load.seconds, load.triangles);
+    std::filesystem::remove(path);
+
+    mesh.build();
+    auto triangles = double(mesh.triangle_count());
+    std::cout << "  " << load.triangles << " triangles, " << load.vertices << " vertices, "
+              << file_bytes / 1e6 << " MB of OBJ\n  ";
+    mesh.build_report().print(std::cout);
+    std::cout << "  " << mesh.memory_bytes() / triangles << " bytes/triangle (vertex buffers "
+              << (mesh.positions.size() * sizeof(point3) + mesh.normals.size() * sizeof(vec3)
+                  + mesh.uvs.size() * sizeof(mesh_uv)) / triangles
+              << ", indices " << 3 * 3 * sizeof(uint32_t) << ")\n";
+
+    seed_random(5);
+    auto rays = random_rays_into(mesh.bounding_box(), 500'000);
+    auto result = trace_rays(mesh, rays);
+    std::cout << "  " << result.mrays_per_second << " Mrays/s, " << result.hits << " hits\n";
+
+    // Rays from the inside of the tube aimed exactly at vertices and edge midpoints, where a
+    // test that is not watertight lets rays slip between neighbouring triangles.
+    long leaks = 0, probes = 0;
+    hit_record rec;
+    for (int i = 0; i < rings; i += 7) {
+        auto u = 2 * pi * i / rings;
+        for (int j = 0; j < sides; j += 3) {
+            auto origin = point3(major * std::cos(u), 0.1 * minor, major * std::sin(u));
+            auto& p0 = mesh.positions[i * sides + j];
+            auto& p1 = mesh.positions[i * sides + (j + 1) % sides];
+            for (auto target : {p0, 0.5 * (p0 + p1)}) {
+                probes++;
+                if (!mesh.hit(ray(origin, target - origin), interval(0.001, infinity), rec))
+                    leaks++;
+            }
+        }
+    }
+    std::cout << "  " << leaks << " of " << probes << " rays through vertices and edges escaped\n";
+}
+
+void bench_instancing() {
+    std::cout << "\n== Instancing: copies of final_scene's sphere cluster under a top-level BVH ==\n";
+    std::cout << std::setw(10) << "instances" << std::setw(22) << "layout" << std::setw(12) << "build ms"
+              << std::setw(16) << "bytes/instance" << std::setw(10) << "Mrays/s" << std::setw(10) << "hits"
+              << '\n';
+
+    // The bottom level, shared by every instance.
+    auto blas = make_shared<sphere_batch>();
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    seed_random(3);
+    for (int i = 0; i < 1000; i++)
+        blas->add(point3::random(0, 165), 10, white);
+    blas->build();
+
+    auto row = [](size_t count, const char* layout, double build, double bytes, const traversal_result& result) {
+        std::cout << std::setw(10) << count << std::setw(22) << layout << std::setw(12) << 1000 * build
+                  << std::setw(16) << bytes << std::setw(10) << result.mrays_per_second
+                  << std::setw(10) << result.hits << '\n';
+    };
+
+    for (int count : {1000, 100'000}) {
+        // Spread over a volume that grows with the count, so the density stays the same.
+        auto extent = 2000 * std::cbrt(count / 1000.0);
+        std::vector<vec3> offsets(count);
+        std::vector<double> angles(count);
+        std::vector<affine_transform> general(count);
+        seed_random(6);
+        for (int i = 0; i < count; i++) {
+            offsets[i] = vec3::random(0, extent);
+            angles[i] = random_double(0, 360);
+            general[i] = affine_transform::translation(offsets[i])
+                       * affine_transform::rotation(random_unit_vector(), angles[i])
+                       * affine_transform::scaling(random_double(0.5, 1.5));
+        }
+
+        // The same turns about Y, once as nested wrappers and once as instances.
+        auto build_start = bench_clock::now();
+        hittable_list wrappers;
+        for (int i = 0; i < count; i++)
+            wrappers.add(make_shared<translate>(make_shared<rotate_y>(blas, angles[i]), offsets[i]));
+        linear_bvh wrapped(wrappers);
+        auto wrapped_build = seconds_since(build_start);
+
+        build_start = bench_clock::now();
+        std::vector<instance> placements;
+        for (int i = 0; i < count; i++) {
+            placements.emplace_back(blas, affine_transform::translation(offsets[i])
+                                          * affine_transform::rotation(vec3(0,1,0), angles[i]));
+        }
+        instance_bvh instanced(std::move(placements));
+        auto instanced_build = seconds_since(build_start);
+
+        build_start = bench_clock::now();
+        std::vector<instance> general_placements;
+        for (const auto& transform : general)
+            general_placements.emplace_back(blas, transform);
+        instance_bvh general_instanced(std::move(general_placements));
+        auto general_build = seconds_since(build_start);
+
+        seed_random(7);
+        auto rays = random_rays_into(wrapped.bounding_box(), 200'000);
+
+        long mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i += 31) {
+            hit_record a, b;
+            auto hit_a = wrapped.hit(rays[i], interval(0.001, infinity), a);
+            auto hit_b = instanced.hit(rays[i], interval(0.001, infinity), b);
+            if (hit_a != hit_b || (hit_a && std::fabs(a.t - b.t) > 1e-6 * a.t))
+                mismatches++;
+        }
+
+        // A wrapped copy: translate and rotate_y with their make_shared control blocks, the
+        // shared_ptrs held by the wrappers, the list and linear_bvh, plus linear_bvh's arrays.
+        auto n = double(count);
+        auto wrapped_bytes = sizeof(translate) + sizeof(rotate_y) + 2 * 2 * sizeof(void*)
+                           + 4 * sizeof(shared_ptr<hittable>) + wrapped.memory_bytes() / n;
+
+        row(count, "translate+rotate_y", wrapped_build, wrapped_bytes, trace_rays(wrapped, rays));
+        row(count, "instance_bvh", instanced_build, instanced.memory_bytes() / n, trace_rays(instanced, rays));
+        row(count, "instance_bvh affine", general_build, general_instanced.memory_bytes() / n,
+            trace_rays(general_instanced, random_rays_into(general_instanced.bounding_box(), 200'000)));
+        if (mismatches)
+            std::cout << "  " << mismatches << " differing hits\n";
+        std::cout << "  shared cluster: " << blas->memory_bytes() << " bytes; flattened, the "
+                  << count << " copies would take " << n * blas->memory_bytes() / 1e6 << " MB\n";
+    }
+}
+
+void bench_shading() {
+    std::cout << "\n== Material shading: emitted + scatter per bounce, and whole renders ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(12) << "bounces" << std::setw(14) << "ns/bounce"
+              << std::setw(16) << "render Ksamp/s" << '\n';
+
+    struct shading_scene {
+        const char* name;
+        scene s;
+    };
+    seed_random(9);
+    shading_scene scenes[] = {
+        {"checkered_spheres", checkered_spheres()},
+        {"final_scene", final_scene(400, 1, 4)},
+    };
+
+    for (auto& [name, s] : scenes) {
+        // Hits of camera rays and of their first bounces, so that every material and texture of
+        // the scene shows up in proportion to how often it is shaded.
+        struct bounce {
+            ray r;
+            hit_record rec;
+        };
+        std::vector<bounce> bounces;
+        seed_random(10);
+        auto rays = primary_rays(s.cam, 200);
+        for (int depth = 0; depth < 3 && !rays.empty(); depth++) {
+            std::vector<ray> next;
+            for (const auto& r : rays) {
+                hit_record rec;
+                if (!s.world.hit(r, interval(0.001, infinity), rec))
+                    continue;
+                bounces.push_back({r, rec});
+
+                color attenuation;
+                ray scattered;
+                if (rec.mat->scatter(r, rec, attenuation, scattered))
+                    next.push_back(scattered);
+            }
+            rays = std::move(next);
+        }
+
+        // The fastest of several passes, since the loop is short enough to be thrown off by
+        // anything else running on the machine.
+        double sink = 0;
+        double best = infinity;
+        for (int pass = 0; pass < 20; pass++) {
+            auto start = bench_clock::now();
+            for (const auto& b : bounces) {
+                color attenuation;
+                ray scattered;
+                auto emitted = b.rec.mat->emitted(b.rec.u, b.rec.v, b.rec.p);
+                if (b.rec.mat->scatter(b.r, b.rec, attenuation, scattered))
+                    sink += attenuation.x() + scattered.direction().y();
+                sink += emitted.z();
+            }
+            best = std::fmin(best, seconds_since(start));
+        }
+        auto ns = 1e9 * best / bounces.size();
+
+        camera cam = s.cam;
+        cam.image_width       = 100;
+        cam.samples_per_pixel = 8;
+        cam.max_depth         = 10;
+        cam.number_of_threads = 1;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        auto start = bench_clock::now();
+        cam.render_samples(s.world);
+        auto samples = double(cam.image_width) * int(cam.image_width / cam.aspect_ratio) * cam.samples_per_pixel;
+        auto render_rate = samples / seconds_since(start) / 1e3;
+
+        std::cout << std::setw(18) << name << std::setw(12) << bounces.size() << std::setw(14) << ns
+                  << std::setw(16) << render_rate << (sink == 0.123 ? " " : "") << '\n';
+    }
+}
+
+void bench_scene_arena() {
+    std::cout << "\n== Scene construction in a scene_arena vs one heap allocation per object ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(8) << "arena" << std::setw(12) << "build ms"
+              << std::setw(14) << "teardown ms" << std::setw(16) << "render Ksamp/s" << std::setw(10)
+              << "objects" << std::setw(8) << "types" << '\n';
+
+    std::pair<const char*, std::function<scene()>> builders[] = {
+        {"bouncing_spheres", [] { return bouncing_spheres(); }},
+        {"cornell_box",      [] { return cornell_box(); }},
+        {"final_scene",      [] { return final_scene(400, 1, 4); }},
+    };
+
+    for (const auto& [name, build] : builders) {
+        for (bool in_arena : {false, true}) {
+            build_scenes_in_arena = in_arena;
+
+            // Fastest of a few builds and teardowns; the last scene is kept for rendering.
+            double build_seconds = infinity, teardown_seconds = infinity;
+            scene s;
+            for (int round = 0; round < 5; round++) {
+                auto start = bench_clock::now();
+                s = scene();
+                if (round > 0)
+                    teardown_seconds = std::fmin(teardown_seconds, seconds_since(start));
+
+                seed_random(11);
+                start = bench_clock::now();
+                s = build();
+                build_seconds = std::fmin(build_seconds, seconds_since(start));
+            }
+
+            camera cam = s.cam;
+            cam.image_width       = 100;
+            cam.samples_per_pixel = 8;
+            cam.max_depth         = 10;
+            cam.number_of_threads = 1;
+            cam.log_progress      = false;
+            cam.report_tile_times = false;
+            cam.render_samples(s.world);
+            auto rate = double(cam.image_width) * cam.height() * cam.samples_per_pixel / cam.last_render_time();
+
+            std::cout << std::setw(18) << name << std::setw(8) << (in_arena ? "yes" : "no")
+                      << std::setw(12) << 1000 * build_seconds << std::setw(14) << 1000 * teardown_seconds
+                      << std::setw(16) << rate / 1e3
+                      << std::setw(10) << (s.arena ? s.arena->object_count() : 0)
+                      << std::setw(8) << (s.arena ? s.arena->type_count() : 0) << '\n';
+        }
+    }
+    build_scenes_in_arena = true;
+}
+
+void bench_wavefront() {
+    std::cout << "\n== final_scene: recursive vs wavefront integrator, 200 px, 16 spp, depth 8 ==\n";
+    std::cout << std::setw(12) << "integrator" << std::setw(10) << "threads" << std::setw(16)
+              << "render Ksamp/s" << std::setw(14) << "mean lum" << '\n';
+
+    seed_random(12);
+    auto s = final_scene(400, 1, 4);
+    int threads[] = {1, int(std::max(1u, std::thread::hardware_concurrency()))};
+
+    for (auto thread_count : threads) {
+        for (bool wavefront : {false, true}) {
+            camera cam = s.cam;
+            cam.image_width       = 200;
+            cam.samples_per_pixel = 16;
+            cam.max_depth         = 8;
+            cam.number_of_threads = thread_count;
+            cam.wavefront         = wavefront;
+            cam.log_progress      = false;
+            cam.report_tile_times = false;
+
+            // Fastest of three renders. The mean luminance of the two integrators should agree to
+            // within the noise of the image.
+            double best = infinity;
+            for (int round = 0; round < 3; round++) {
+                cam.render_samples(s.world);
+                best = std::fmin(best, cam.last_render_time());
+            }
+
+            double mean = 0;
+            for (const auto& c : cam.framebuffer())
+                mean += luminance(c);
+            mean /= double(cam.image_width) * cam.height();
+
+            auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+            std::cout << std::setw(12) << (wavefront ? "wavefront" : "recursive") << std::setw(10)
+                      << thread_count << std::setw(16) << samples / best / 1e3 << std::setw(14) << mean
+                      << '\n';
+        }
+        if (threads[1] == 1)
+            break;
+    }
+}
+
+void bench_russian_roulette() {
+    std::cout << "\n== Russian roulette: paths of up to 50 bounces, 100 px, 16 spp ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(10) << "roulette" << std::setw(16)
+              << "render Ksamp/s" << std::setw(14) << "rays/sample" << std::setw(12) << "mean lum" << '\n';
+
+    std::pair<const char*, std::function<scene()>> builders[] = {
+        {"cornell_box",   [] { return cornell_box(); }},
+        {"cornell_smoke", [] { return cornell_smoke(); }},
+        {"final_scene",   [] { return final_scene(400, 1, 4); }},
+    };
+
+    for (const auto& [name, build] : builders) {
+        seed_random(13);
+        auto s = build();
+
+        for (bool roulette : {false, true}) {
+            camera cam = s.cam;
+            cam.image_width       = 100;
+            cam.samples_per_pixel = 16;
+            cam.max_depth         = 50;
+            cam.russian_roulette  = roulette;
+            cam.number_of_threads = 1;
+            cam.log_progress      = false;
+            cam.report_tile_times = false;
+
+            // Fastest of three renders; the mean luminance should not move with roulette on.
+            double best = infinity;
+            for (int round = 0; round < 3; round++) {
+                cam.render_samples(s.world);
+                best = std::fmin(best, cam.last_render_time());
+            }
+
+            double mean = 0;
+            for (const auto& c : cam.framebuffer())
+                mean += luminance(c);
+            mean /= double(cam.image_width) * cam.height();
+
+            auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+            std::cout << std::setw(18) << name << std::setw(10) << (roulette ? "yes" : "no")
+                      << std::setw(16) << samples / best / 1e3 << std::setw(14) << cam.average_path_length()
+                      << std::setw(12) << mean << '\n';
+        }
+    }
+}
+
+enum class rmse_encoding {
+    linear,   // The radiance itself
+    clamped,  // Clamped to 1 as displayed, so that lights far above 1 do not swamp the rest
+    gamma     // Gamma encoded, as the output image is written
+};
+
+double image_rmse(const std::vector<color>& image, const std::vector<color>& reference,
+                  rmse_encoding encoding) {
+    // Root mean square error over the pixels and channels, of the values in the given encoding.
+    auto encode = [&](const color& c) {
+        switch (encoding) {
+            case rmse_encoding::clamped:
+                return color(std::min(c.x(), 1.0), std::min(c.y(), 1.0), std::min(c.z(), 1.0));
+            case rmse_encoding::gamma:
+                return color(linear_to_gamma(c.x()), linear_to_gamma(c.y()), linear_to_gamma(c.z()));
+            default:
+                return c;
+        }
+    };
+
+    double sum = 0;
+    for (size_t p = 0; p < image.size(); p++) {
+        auto d = encode(image[p]) - encode(reference[p]);
+        sum += d.length_squared() / 3;
+    }
+    return std::sqrt(sum / image.size());
+}
+
+void bench_light_sampling() {
+    std::cout << "\n== Light sampling (NEE + MIS): RMSE against a 1024 spp reference, 100 px ==\n";
+    std::cout << std::setw(14) << "scene" << std::setw(6) << "NEE" << std::setw(8) << "spp"
+              << std::setw(12) << "seconds" << std::setw(12) << "RMSE" << std::setw(16) << "RMSE^2*seconds"
+              << '\n';
+
+    std::pair<const char*, std::function<scene()>> builders[] = {
+        {"cornell_box",   [] { return cornell_box(); }},
+        {"cornell_smoke", [] { return cornell_smoke(); }},
+        {"simple_light",  [] { return simple_light(); }},
+    };
+
+    for (const auto& [name, build] : builders) {
+        seed_random(14);
+        auto s = build();
+
+        camera cam = s.cam;
+        cam.image_width       = 100;
+        cam.max_depth         = 50;
+        cam.number_of_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        // The reference uses light sampling and a seed of its own.
+        cam.samples_per_pixel = 1024;
+        cam.seed              = 1;
+        cam.sample_lights     = true;
+        cam.render_samples(s.world, s.lights);
+        auto reference = cam.framebuffer();
+
+        cam.number_of_threads = 1;
+        cam.seed              = 2;
+        for (bool nee : {false, true}) {
+            cam.sample_lights = nee;
+            for (int spp : {4, 16, 64}) {
+                cam.samples_per_pixel = spp;
+                cam.render_samples(s.world, s.lights);
+                auto rmse = image_rmse(cam.framebuffer(), reference, rmse_encoding::linear);
+
+                // RMSE^2 times time is constant for an unbiased estimator; lower is more
+                // efficient, and the ratio is how much longer one takes for the same noise.
+                std::cout << std::setw(14) << name << std::setw(6) << (nee ? "yes" : "no")
+                          << std::setw(8) << spp << std::setw(12) << cam.last_render_time()
+                          << std::setw(12) << rmse << std::setw(16) << rmse * rmse * cam.last_render_time()
+                          << '\n';
+            }
+        }
+    }
+}
+
+void bench_denoiser() {
+    std::cout << "\n== Denoiser: RMSE of the displayed (clamped) image against a 4096 spp reference, 100 px ==\n";
+    std::cout << std::setw(14) << "scene" << std::setw(8) << "spp" << std::setw(12) << "RMSE"
+              << std::setw(12) << "denoised" << std::setw(12) << "render s" << std::setw(12) << "denoise s"
+              << '\n';
+
+    std::pair<const char*, std::function<scene()>> builders[] = {
+        {"cornell_box",   [] { return cornell_box(); }},
+        {"cornell_smoke", [] { return cornell_smoke(); }},
+    };
+
+    for (const auto& [name, build] : builders) {
+        seed_random(14);
+        auto s = build();
+
+        camera cam = s.cam;
+        cam.image_width       = 100;
+        cam.max_depth         = 50;
+        cam.number_of_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        cam.samples_per_pixel = 4096;
+        cam.seed              = 1;
+        cam.render_samples(s.world, s.lights);
+        auto reference = cam.framebuffer();
+
+        // The low sample counts are denoised; the reference shows how many samples the same
+        // error would take without.
+        cam.denoise = true;
+        cam.seed    = 2;
+        for (int spp : {16, 64, 256}) {
+            cam.samples_per_pixel = spp;
+            cam.render_samples(s.world, s.lights);
+
+            auto start = bench_clock::now();
+            auto denoised = cam.denoised_framebuffer();
+            auto denoise_seconds = seconds_since(start);
+
+            std::cout << std::setw(14) << name << std::setw(8) << spp
+                      << std::setw(12) << image_rmse(cam.framebuffer(), reference, rmse_encoding::clamped)
+                      << std::setw(12) << image_rmse(denoised, reference, rmse_encoding::clamped)
+                      << std::setw(12) << cam.last_render_time() << std::setw(12) << denoise_seconds
+                      << '\n';
+        }
+    }
+}
+
+void bench_aovs() {
+    std::cout << "\n== cornell_box: render with no AOVs vs all of them, 200 px, 16 spp, 1 thread ==\n";
+    std::cout << std::setw(12) << "integrator" << std::setw(14) << "none Ksamp/s" << std::setw(14)
+              << "all Ksamp/s" << std::setw(12) << "overhead" << '\n';
+
+    seed_random(14);
+    auto s = cornell_box();
+
+    uint32_t all = 0;
+    for (int i = 0; i < aov_count; i++)
+        all |= aov_bit(aov(i));
+
+    for (bool wavefront : {false, true}) {
+        camera cam = s.cam;
+        cam.image_width       = 200;
+        cam.samples_per_pixel = 16;
+        cam.max_depth         = 50;
+        cam.number_of_threads = 1;
+        cam.wavefront         = wavefront;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        // Fastest of three renders each, alternating so that drift hits both alike.
+        double best[2] = {infinity, infinity};
+        for (int round = 0; round < 3; round++) {
+            for (int with_aovs = 0; with_aovs < 2; with_aovs++) {
+                cam.aovs = with_aovs ? all : 0;
+                cam.render_samples(s.world, s.lights);
+                best[with_aovs] = std::fmin(best[with_aovs], cam.last_render_time());
+            }
+        }
+
+        auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+        std::cout << std::setw(12) << (wavefront ? "wavefront" : "recursive")
+                  << std::setw(14) << samples / best[0] / 1e3 << std::setw(14) << samples / best[1] / 1e3
+                  << std::setw(11) << 100 * (best[1] / best[0] - 1) << "%\n";
+    }
+}
+
+void bench_ray_packets() {
+    std::cout << "\n== primary rays: single rays vs packets of 2x2, 4x2 and 4x4 pixels, Mrays/s ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(10) << "single" << std::setw(10) << "4"
+              << std::setw(10) << "8" << std::setw(10) << "16" << std::setw(10) << "hits ok" << '\n';
+
+    // final_scene's volumes pick a random scattering distance for every ray, so its hits can
+    // only be compared between runs that trace the rays in the same order.
+    struct packet_scene {
+        const char* name;
+        std::function<scene()> build;
+        bool deterministic;
+    };
+    std::vector<packet_scene> scenes = {
+        {"bouncing_spheres", [] { return bouncing_spheres(); },        true},
+        {"cornell_box",      [] { return cornell_box(); },             true},
+        {"final_scene",      [] { return final_scene(400, 256, 4); }, false},
+    };
+
+    const int width = 800;
+    const int blocks[3][2] = {{2, 2}, {4, 2}, {4, 4}};
+
+    for (const auto& entry : scenes) {
+        seed_random(5);
+        auto s = entry.build();
+        linear_bvh world(s.world);
+        auto rays = primary_rays(s.cam, width);
+
+        auto single = trace_rays(world, rays);
+        std::cout << std::setw(18) << entry.name << std::setw(10) << single.mrays_per_second;
+
+        bool hits_match = true;
+        for (const auto& block : blocks) {
+            auto packets = trace_packets(world, rays, width, block[0], block[1]);
+            hits_match = hits_match && packets.hits == single.hits;
+            std::cout << std::setw(10) << packets.mrays_per_second;
+        }
+        std::cout << std::setw(10) << (!entry.deterministic ? "-" : hits_match ? "yes" : "NO") << '\n';
+    }
+
+    // The camera packs the samples of a pixel, rather than neighboring pixels, into a packet.
+    std::cout << "camera::render_samples, bouncing_spheres, samples/s:\n";
+    seed_random(5);
+    auto s = bouncing_spheres();
+    for (auto packet_size : {0, 4, 8, 16}) {
+        auto cam = s.cam;
+        cam.image_width       = 200;
+        cam.samples_per_pixel = 32;
+        cam.max_depth         = 10;
+        cam.packet_size       = packet_size;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+        cam.render_samples(s.world);
+
+        auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+        std::cout << std::setw(18) << "packet_size " << std::setw(2) << packet_size
+                  << std::setw(14) << samples / cam.last_render_time() << '\n';
+    }
+}
+
+void bench_parallel_build() {
+    std::cout << "\n== Parallel BVH build: procedural spheres in the style of boxes2 ==\n";
+    std::cout << std::setw(10) << "prims" << std::setw(8) << "threads" << std::setw(12) << "build ms"
+              << std::setw(10) << "nodes" << std::setw(10) << "SAH" << std::setw(10) << "hits" << '\n';
+
+    const int count = 2'000'000;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+    // Only the bounds matter for the build; the spheres are kept to trace against the result.
+    seed_random(6);
+    hittable_list spheres;
+    spheres.objects.reserve(count);
+    for (int j = 0; j < count; j++)
+        spheres.add(make_shared<sphere>(point3::random(0, 1650), 1, white));
+
+    seed_random(7);
+    auto rays = random_rays_into(spheres.bounding_box(), 100'000);
+
+    for (int threads : {1, 2, 4, 8, 16}) {
+        bvh_build_options options;
+        options.build_threads = threads;
+
+        linear_bvh bvh(spheres, options);
+        auto result = trace_rays(bvh, rays);
+
+        const auto& report = bvh.build_report();
+        std::cout << std::setw(10) << count << std::setw(8) << threads
+                  << std::setw(12) << 1000 * report.build_seconds
+                  << std::setw(10) << report.nodes
+                  << std::setw(10) << report.sah_cost
+                  << std::setw(10) << result.hits << '\n';
+    }
+}
+
+void bench_image_writers() {
+    std::cout << "\n== Image output: 3840x2160 framebuffer encode ==\n";
+    std::cout << std::setw(20) << "writer" << std::setw(12) << "ms" << std::setw(14) << "bytes" << '\n';
+
+    const int width = 3840, height = 2160;
+    seed_random(8);
+    std::vector<color> pixels(width * height);
+    for (auto& p : pixels)
+        p = color::random();
+
+    auto report = [](const char* name, double seconds, size_t bytes) {
+        std::cout << std::setw(20) << name << std::setw(12) << 1000 * seconds
+                  << std::setw(14) << bytes << '\n';
+    };
+
+    // The original path: one formatted write_color per pixel.
+    auto start = bench_clock::now();
+    std::ostringstream legacy;
+    legacy << "P3\n" << width << ' ' << height << "\n255 \n";
+    for (const auto& p : pixels)
+        write_color(legacy, p);
+    report("write_color (P3)", seconds_since(start), legacy.str().size());
+
+    auto threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    std::pair<const char*, image_format> formats[] = {
+        {"P3", image_format::ppm_ascii}, {"P6", image_format::ppm},
+        {"PFM", image_format::pfm},      {"PNG", image_format::png},
+    };
+    for (const auto& [name, format] : formats) {
+        start = bench_clock::now();
+        auto bytes = image_encoder(pixels, width, height, threads).encode(format);
+        report(name, seconds_since(start), bytes.size());
+    }
+}
+
+camera adaptive_bench_camera(camera cam, int samples_per_pixel, uint64_t seed) {
+    cam.image_width       = 96;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth         = 10;
+
+    cam.seed              = seed;
+    cam.log_progress      = false;
+    cam.report_tile_times = false;
+    return cam;
+}
+
+void bench_adaptive_sampling() {
+    // Compares adaptive sampling against uniform sampling at the same average sample count,
+    // measuring RMSE against a high sample count reference rendered with another seed.
+    std::cout << "\n== adaptive vs uniform sampling: RMSE at equal samples per pixel ==\n";
+    std::cout << std::setw(12) << "threshold" << std::setw(10) << "max spp" << std::setw(10) << "avg spp"
+              << std::setw(14) << "adaptive" << std::setw(14) << "uniform"
+              << std::setw(12) << "adapt ms" << std::setw(12) << "unif ms" << '\n';
+
+    std::pair<const char*, scene> scenes[] = {
+        {"bouncing_spheres", bouncing_spheres()},
+        {"simple_light", simple_light()},
+    };
+
+    for (const auto& [name, s] : scenes) {
+        std::cout << name << '\n';
+
+        auto reference_cam = adaptive_bench_camera(s.cam, 1024, 1);
+        reference_cam.render_samples(s.world);
+        auto reference = reference_cam.framebuffer();
+
+        for (auto threshold : {0.2, 0.1, 0.05}) {
+            auto adaptive = adaptive_bench_camera(s.cam, 256, 2);
+            adaptive.adaptive_sampling  = true;
+            adaptive.adaptive_threshold = threshold;
+            adaptive.render_samples(s.world);
+
+            auto spp = adaptive.average_samples_per_pixel();
+            auto uniform = adaptive_bench_camera(s.cam, std::max(1, int(std::lround(spp))), 2);
+            uniform.render_samples(s.world);
+
+            std::cout << std::setw(12) << threshold << std::setw(10) << adaptive.samples_per_pixel
+                      << std::setw(10) << spp
+                      << std::setw(14) << image_rmse(adaptive.framebuffer(), reference, rmse_encoding::gamma)
+                      << std::setw(14) << image_rmse(uniform.framebuffer(), reference, rmse_encoding::gamma)
+                      << std::setw(12) << 1000 * adaptive.last_render_time()
+                      << std::setw(12) << 1000 * uniform.last_render_time() << '\n';
+        }
+    }
+}
+
+// The suite: kernel microbenchmarks and full-scene renders with fixed seeds, reported as a
+// table and optionally as JSON, so that runs can be compared across commits.
+
+struct suite_result {
+    std::string name;
+    std::vector<std::pair<std::string, double>> values;  // Metric name and value, in order
+};
+
+volatile double suite_sink;  // Kernel results go here, so the calls are not optimized away
+
+template <typename Op>
+double nanoseconds_per_op(size_t ops, Op op) {
+    // Fastest of five runs of op(0) .. op(ops - 1), in nanoseconds per call.
+    double best = infinity;
+    double sum = 0;
+    for (int round = 0; round < 5; round++) {
+        auto start = bench_clock::now();
+        for (size_t i = 0; i < ops; i++)
+            sum += op(i);
+        best = std::fmin(best, seconds_since(start));
+    }
+    suite_sink = sum;
+    return 1e9 * best / ops;
+}
+
+std::vector<suite_result> suite_kernels() {
+    std::cout << "\n== Kernels ==\n";
+    std::cout << std::setw(22) << "kernel" << std::setw(12) << "ns/op" << std::setw(12) << "Mops/s" << '\n';
+
+    std::vector<suite_result> results;
+    auto report = [&](const char* name, double ns, size_t ops) {
+        std::cout << std::setw(22) << name << std::setw(12) << ns << std::setw(12) << 1e3 / ns << '\n';
+        results.push_back({name, {{"ns_per_op", ns}, {"ops", double(ops)}}});
+    };
+
+    // Rays are reused from a table small enough to stay in cache, so the kernels are timed
+    // rather than memory.
+    const size_t ops = 2'000'000;
+    const size_t table_mask = 4095;
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    {
+        aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+        seed_random(21);
+        auto rays = random_rays_into(aabb(point3(-1.5, -1.5, -1.5), point3(1.5, 1.5, 1.5)), table_mask + 1);
+        report("aabb::hit", nanoseconds_per_op(ops, [&](size_t i) {
+            return double(box.hit(rays[i & table_mask], interval(0.001, infinity)));
+        }), ops);
+    }
+    {
+        sphere ball(point3(0, 0, 0), 1, mat);
+        seed_random(22);
+        auto rays = random_rays_into(aabb(point3(-1.5, -1.5, -1.5), point3(1.5, 1.5, 1.5)), table_mask + 1);
+        hit_record rec;
+        report("sphere::hit", nanoseconds_per_op(ops, [&](size_t i) {
+            return double(ball.hit(rays[i & table_mask], interval(0.001, infinity), rec));
+        }), ops);
+    }
+    {
+        quad square(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+        seed_random(23);
+        auto rays = random_rays_into(aabb(point3(-1.5, -1.5, -0.5), point3(1.5, 1.5, 0.5)), table_mask + 1);
+        hit_record rec;
+        report("quad::hit", nanoseconds_per_op(ops, [&](size_t i) {
+            return double(square.hit(rays[i & table_mask], interval(0.001, infinity), rec));
+        }), ops);
+    }
+    {
+        seed_random(24);
+        perlin noise;
+        std::vector<point3> points(table_mask + 1);
+        for (auto& p : points)
+            p = point3::random(0, 10);
+        report("perlin::turb", nanoseconds_per_op(ops / 4, [&](size_t i) {
+            return noise.turb(points[i & table_mask], 7);
+        }), ops / 4);
+    }
+    {
+        if (rtw_image("earthmap.jpg").height() <= 0) {
+            std::cout << std::setw(22) << "image_texture::value" << "  skipped: earthmap.jpg not found\n";
+        } else {
+            image_texture earth_texture("earthmap.jpg");
+            seed_random(25);
+            std::vector<std::pair<double, double>> uvs(table_mask + 1);
+            for (auto& uv : uvs)
+                uv = {random_double(), random_double()};
+            report("image_texture::value", nanoseconds_per_op(ops, [&](size_t i) {
+                const auto& [u, v] = uvs[i & table_mask];
+                return earth_texture.value(u, v, point3()).x();
+            }), ops);
+        }
+    }
+    {
+        // Binned SAH build of 100k spheres; ns/op is per sphere.
+        auto spheres = random_spheres(100'000);
+        double best = infinity;
+        size_t nodes = 0;
+        for (int round = 0; round < 3; round++) {
+            auto start = bench_clock::now();
+            linear_bvh tree(spheres);
+            best = std::fmin(best, seconds_since(start));
+            nodes = tree.node_count();
+        }
+        auto ns = 1e9 * best / spheres.objects.size();
+        std::cout << std::setw(22) << "linear_bvh build" << std::setw(12) << ns << std::setw(12) << 1e3 / ns
+                  << "   (" << 1000 * best << " ms, " << nodes << " nodes)\n";
+        results.push_back({"linear_bvh build", {
+            {"ns_per_op", ns}, {"ops", double(spheres.objects.size())}, {"build_ms", 1000 * best},
+            {"nodes", double(nodes)}
+        }});
+    }
+
+    return results;
+}
+
+std::vector<suite_result> suite_scenes(int threads) {
+    std::cout << "\n== Scenes: 160 px, 16 spp, " << threads << " thread(s) ==\n";
+    std::cout << std::setw(18) << "scene" << std::setw(12) << "build ms" << std::setw(12) << "render s"
+              << std::setw(10) << "Mrays/s" << std::setw(12) << "Ksamp/s" << std::setw(12) << "rays/samp"
+              << '\n';
+
+    // The scenes of RayTracer's main(), in its order, with final_scene built as main() builds
+    // it by default.
+    std::pair<const char*, std::function<scene()>> builders[] = {
+        {"bouncing_spheres",  [] { return bouncing_spheres(); }},
+        {"checkered_spheres", [] { return checkered_spheres(); }},
+        {"earth",             [] { return earth(); }},
+        {"perlin_spheres",    [] { return perlin_spheres(); }},
+        {"quads",             [] { return quads(); }},
+        {"simple_light",      [] { return simple_light(); }},
+        {"cornell_box",       [] { return cornell_box(); }},
+        {"cornell_smoke",     [] { return cornell_smoke(); }},
+        {"final_scene",       [] { return final_scene(400, 256, 4); }},
+    };
+
+    std::vector<suite_result> results;
+    for (const auto& [name, build] : builders) {
+        seed_random(31);
+        auto start = bench_clock::now();
+        auto s = build();
+        auto build_seconds = seconds_since(start);
+
+        camera cam = s.cam;
+        cam.image_width       = 160;
+        cam.samples_per_pixel = 16;
+        cam.seed              = 1;
+        cam.number_of_threads = threads;
+        cam.log_progress      = false;
+        cam.report_tile_times = false;
+
+        // Fastest of three renders; the seed makes them trace the same rays.
+        double seconds = infinity;
+        for (int round = 0; round < 3; round++) {
+            cam.render_samples(s.world, s.lights);
+            seconds = std::fmin(seconds, cam.last_render_time());
+        }
+
+        auto samples = double(cam.image_width) * cam.height() * cam.samples_per_pixel;
+        auto rays = samples * cam.average_path_length();
+
+        std::cout << std::setw(18) << name << std::setw(12) << 1000 * build_seconds
+                  << std::setw(12) << seconds << std::setw(10) << rays / seconds / 1e6
+                  << std::setw(12) << samples / seconds / 1e3 << std::setw(12) << cam.average_path_length()
+                  << '\n';
+        results.push_back({name, {
+            {"build_ms", 1000 * build_seconds}, {"render_seconds", seconds},
+            {"mrays_per_second", rays / seconds / 1e6}, {"ksamples_per_second", samples / seconds / 1e3},
+            {"rays_per_sample", cam.average_path_length()}, {"width", double(cam.image_width)},
+            {"height", double(cam.height())}, {"samples_per_pixel", double(cam.samples_per_pixel)}
+        }});
+    }
+    return results;
+}
+
+std::string json_string(const std::string& text) {
+    std::string quoted = "\"";
+    for (auto c : text) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void write_suite_json(
+    std::ostream& out, const std::string& label, int threads,
+    const std::vector<suite_result>& kernels, const std::vector<suite_result>& scenes
+) {
+    auto write_results = [&](const std::vector<suite_result>& results) {
+        out << "[";
+        for (size_t i = 0; i < results.size(); i++) {
+            out << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(results[i].name);
+            for (const auto& [key, value] : results[i].values)
+                out << ", " << json_string(key) << ": " << value;
+            out << "}";
+        }
+        out << (results.empty() ? "]" : "\n  ]");
+    };
+
+    out << std::setprecision(6);
+    out << "{\n  \"label\": " << json_string(label) << ",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"counters\": " << (render_stats_enabled ? "true" : "false") << ",\n";
+    out << "  \"kernels\": ";
+    write_results(kernels);
+    out << ",\n  \"scenes\": ";
+    write_results(scenes);
+    out << "\n}\n";
+}
+
+void run_studies() {
+    // The longer comparisons made for individual changes, kept to rerun by hand.
+    std::vector<int> thread_counts = {1, 4, 16};
+
+    bench_random(thread_counts);
+    bench_render(thread_counts);
+    bench_scene_scaling(thread_counts);
+    bench_box_tests();
+    bench_bvh_layouts();
+    bench_sphere_batch();
+    bench_triangle_mesh();
+    bench_instancing();
+    bench_shading();
+    bench_scene_arena();
+    bench_wavefront();
+    bench_russian_roulette();
+    bench_light_sampling();
+    bench_denoiser();
+    bench_aovs();
+    bench_bvh_builders();
+    bench_ray_packets();
+    bench_parallel_build();
+    bench_image_writers();
+    bench_adaptive_sampling();
+}
+
+int main(int argc, char* argv[]) {
+    // Usage: RayTracerBench [--kernels] [--scenes] [--studies] [--threads n] [--json file]
+    //                       [--label text]
+    // Without a selection, runs the kernels and scenes. --json writes their results as JSON
+    // ("-" for std::cout, with the tables on std::clog), tagged with the label (a commit, say).
+    // RayTracerBenchStats is the same with the RT_STATS counters, which fill in the studies'
+    // nodes/ray columns ("-" without them); its timings include the counting.
+    bool kernels = false, scenes = false, studies = false;
+    int threads = 1;
+    std::string json_path, label;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--kernels")
+            kernels = true;
+        else if (arg == "--scenes")
+            scenes = true;
+        else if (arg == "--studies")
+            studies = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--label" && i + 1 < argc)
+            label = argv[++i];
+        else {
+            std::cerr << "Unknown argument '" << arg << "'.\n";
+            return 1;
+        }
+    }
+    if (!kernels && !scenes && !studies)
+        kernels = scenes = true;
+
+    // With --json -, stdout carries only the JSON document; the tables go to std::clog.
+    auto cout_buffer = std::cout.rdbuf();
+    if (json_path == "-")
+        std::cout.rdbuf(std::clog.rdbuf());
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << '\n';
+
+    std::vector<suite_result> kernel_results, scene_results;
+    if (kernels)
+        kernel_results = suite_kernels();
+    if (scenes)
+        scene_results = suite_scenes(threads);
+    if (studies)
+        run_studies();
+
+    std::cout.rdbuf(cout_buffer);
+    if (json_path == "-") {
+        write_suite_json(std::cout, label, threads, kernel_results, scene_results);
+    } else if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        write_suite_json(out, label, threads, kernel_results, scene_results);
+        if (!out) {
+            std::cerr << "ERROR: Could not write '" << json_path << "'.\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class aov {
+    // Arbitrary output variables: what the camera rays hit first, besides the radiance.
+    depth,        // Distance to the hit
+    normal,       // Shading normal, facing the ray
+    albedo,       // material::albedo_at(); white where the ray missed
+    emission,     // Light emitted by the hit itself, or the background where the ray missed
+    uv,           // Surface coordinates of the hit
+    material_id,  // material::id() of the first sample that hit something, 0 where all missed
+    time          // Time of the camera ray
+};
+
+const int aov_count = 7;
+
+constexpr uint32_t aov_bit(aov a) { return 1u << int(a); }
+
+inline const char* aov_name(aov a) {
+    static const char* names[aov_count] = {"depth", "normal", "albedo", "emission", "uv", "material_id", "time"};
+    return names[int(a)];
+}
+
+inline bool aov_from_name(const std::string& name, aov& a) {
+    for (int i = 0; i < aov_count; i++) {
+        if (name == aov_name(aov(i))) {
+            a = aov(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+class aov_buffers {
+    /* Sums of the selected AOVs over the samples of every pixel, one float buffer per AOV
+       (with one, two or three channels), plus how many samples reached each pixel and how many
+       of them hit something. Depth, normal and uv average over the samples that hit, albedo,
+       emission and time over all of them; the material id is the first hit's, since ids do
+       not average. Sums come in from sample ranges that finish in any order, so add() keeps
+       the id of the range that starts first, which keeps it the same from run to run. AOVs
+       that are not selected take no memory, and with none selected the camera does not record
+       at all. */
+    public:
+        void reset(uint32_t selection, size_t pixel_count) {
+            selected = selection;
+            pixels = selection ? pixel_count : 0;
+            for (int i = 0; i < aov_count; i++) {
+                auto size = has(aov(i)) ? pixels * channels(aov(i)) : 0;
+                buffers[i].assign(size, 0.0f);
+            }
+            samples.assign(pixels, 0);
+            hits.assign(pixels, 0);
+            id_samples.assign(has(aov::material_id) ? pixels : 0, UINT32_MAX);
+        }
+
+        uint32_t selection() const { return selected; }
+        bool     has(aov a)  const { return (selected & aov_bit(a)) != 0; }
+        bool     empty()     const { return pixels == 0; }
+
+        static int channels(aov a) {
+            switch (a) {
+                case aov::normal:
+                case aov::albedo:
+                case aov::emission: return 3;
+                case aov::uv:       return 2;
+                default:            return 1;
+            }
+        }
+
+        void record(size_t p, const ray& r, const hit_record* rec, const color& background) {
+            // Adds one camera sample for pixel p that hit rec, or missed the scene if null.
+            if (rec && has(aov::material_id) && hits[p] == 0)
+                at(aov::material_id, p)[0] = float(rec->mat->id());
+
+            samples[p]++;
+            if (has(aov::time))
+                at(aov::time, p)[0] += float(r.time());
+
+            if (!rec) {
+                if (has(aov::albedo))   add3(aov::albedo, p, color(1,1,1));
+                if (has(aov::emission)) add3(aov::emission, p, background);
+                return;
+            }
+
+            hits[p]++;
+            if (has(aov::depth))    at(aov::depth, p)[0] += float(rec->t * r.direction().length());
+            if (has(aov::normal))   add3(aov::normal, p, rec->normal);
+            if (has(aov::albedo))   add3(aov::albedo, p, rec->mat->albedo_at(*rec));
+            if (has(aov::emission)) add3(aov::emission, p, rec->mat->emitted(rec->u, rec->v, rec->p));
+            if (has(aov::uv)) {
+                at(aov::uv, p)[0] += float(rec->u);
+                at(aov::uv, p)[1] += float(rec->v);
+            }
+        }
+
+        void add(size_t p, const aov_buffers& other, size_t q, uint32_t first_sample) {
+            // Adds the sums of pixel q of other (with the same selection) to pixel p. other
+            // recorded the samples from first_sample on.
+            if (has(aov::material_id) && other.hits[q] > 0 && first_sample < id_samples[p]) {
+                at(aov::material_id, p)[0] = other.at(aov::material_id, q)[0];
+                id_samples[p] = first_sample;
+            }
+
+            for (int i = 0; i < aov_count; i++) {
+                auto a = aov(i);
+                if (!has(a) || a == aov::material_id)
+                    continue;
+                for (int c = 0; c < channels(a); c++)
+                    at(a, p)[c] += other.at(a, q)[c];
+            }
+            samples[p] += other.samples[q];
+            hits[p] += other.hits[q];
+        }
+
+        vec3 average(aov a, size_t p) const {
+            // The AOV of pixel p, with unused channels 0. Normals are made unit length again.
+            if (!has(a))
+                return vec3();
+
+            auto n = (a == aov::depth || a == aov::normal || a == aov::uv) ? hits[p] : samples[p];
+            if (a == aov::material_id)
+                n = 1;
+
+            vec3 v;
+            if (n == 0) {
+                if (a == aov::albedo)
+                    v = color(1,1,1);
+                return v;
+            }
+
+            const float* sums = at(a, p);
+            v = vec3(sums[0], channels(a) > 1 ? sums[1] : 0, channels(a) > 2 ? sums[2] : 0) / n;
+            if (a == aov::normal && v.length_squared() > 1e-12)
+                v = unit_vector(v);
+            return v;
+        }
+
+        std::vector<color> image(aov a) const {
+            // The AOV of every pixel as an image; one-channel AOVs go into all three channels.
+            std::vector<color> result(pixels);
+            for (size_t p = 0; p < pixels; p++) {
+                auto v = average(a, p);
+                result[p] = channels(a) == 1 ? color(v.x(), v.x(), v.x()) : v;
+            }
+            return result;
+        }
+
+    private:
+        uint32_t selected = 0;
+        size_t   pixels   = 0;
+        std::array<std::vector<float>, aov_count> buffers;
+        std::vector<uint32_t> samples;  // Samples taken of each pixel
+        std::vector<uint32_t> hits;     // Samples that hit something
+        std::vector<uint32_t> id_samples;  // First sample of the range the material id came from
+
+        float*       at(aov a, size_t p)       { return buffers[int(a)].data() + p * channels(a); }
+        const float* at(aov a, size_t p) const { return buffers[int(a)].data() + p * channels(a); }
+
+        void add3(aov a, size_t p, const vec3& v) {
+            auto sums = at(a, p);
+            sums[0] += float(v.x());
+            sums[1] += float(v.y());
+            sums[2] += float(v.z());
+        }
+};
+
+#endif
@@ -43,12 +43,13 @@ class bvh_node : public hittable {
                 // get mid point of length
                 auto mid = start + object_span/2;
                 //split elements to left and right
-                left = make_shared<bvh_node>(objects, start, mid);
-                right = make_shared<bvh_node>(objects, mid, end);
+                left = make_scene_object<bvh_node>(objects, start, mid);
+                right = make_scene_object<bvh_node>(objects, mid, end);
             }
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_COUNT(bvh_nodes_visited);
             if(!bbox.hit(r, ray_t))
                 return false;
 
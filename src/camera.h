@@ -1,10 +1,23 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "aov.h"
+#include "checkpoint.h"
+#include "denoiser.h"
 #include "hittable.h"
+#include "hittable_list.h"
 #include "material.h"
-#include <thread>
+#include "scheduler.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
 
 class camera {
     public:
@@ -22,45 +35,218 @@ class camera {
         double defocus_angle = 0;   // Variation angle of rays through each pixel
         double focus_dist    = 10;  // Distance from the camera lookfrom point to the plane of perfect focus
 
-        int number_of_threads = 1;
+        uint64_t seed = 0;  // Base seed; every work item derives its own random stream from it
 
-        void render_process(const hittable& world, std::vector<color>& image) {
+        int number_of_threads = 1;   // Worker threads pulling tiles from the scheduler
+        int tile_size         = 16;  // Width and height of a scheduler tile in pixels
+        int samples_per_task  = 32;  // Samples of one tile rendered per work item (0 = all)
+        int packet_size       = 8;   // Camera rays traced together: 4, 8 or 16 (0 = one at a time)
 
-            // Hacky way ensure that each thread has a different seed.
-            // This is effectively a more precise version of the classic time(NULL) seed typically used
-            // to seed srand() in C.
-            auto now = std::chrono::system_clock::now().time_since_epoch();
-            auto seed = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
-            srand(seed);
+        // Trace each work item as a wavefront: all of its samples bounce by bounce, with the hits
+        // of a bounce grouped by material, instead of one recursive path after another. Adaptive
+        // sampling always traces recursively.
+        bool wavefront       = false;
+        int  wavefront_batch = 256;   // Paths traced together as one wavefront
 
-            for (int j = 0; j < image_height; j++) {
-                /*log progress*/
-                std::clog << "\rScanlines remaining: " << (image_height - j) << " " << std::flush; 
-                
-                for (int i = 0; i < image_width; i++) {
-                    color pixel_color(0,0,0);
-
-                    for (int sample = 0; sample < samples_per_thread; sample++) {
-                        ray r = get_ray(i, j);
-                        //pixel_color += ray_color(r, max_depth, world);
-                        image[i + j*image_width] += ray_color(r, max_depth, world);
-                    }
-                    //write_color(std::cout, pixel_samples_scale * pixel_color);
+        // Russian roulette: after roulette_depth bounces a path goes on with a probability that
+        // follows its throughput (at most roulette_max_survival), and the paths that survive are
+        // weighted up to make up for the ones ended. Unbiased, so max_depth can be set high.
+        bool   russian_roulette      = true;
+        int    roulette_depth        = 4;     // Bounces every path takes before roulette starts
+        double roulette_max_survival = 0.95;  // Even bright paths end now and then (white fog, glass)
+
+        // Next-event estimation: every hit on a material with a density (diffuse surfaces and
+        // media) also sends a shadow ray towards a random point of one of the lights passed to
+        // render(), and the light found that way and the light a scattered ray runs into are
+        // weighted against each other with multiple importance sampling (power heuristic).
+        bool sample_lights = true;
+
+        bool        log_progress      = true;  // Print progress to std::clog while rendering
+        bool        report_tile_times = true;  // Print per-tile wall time summary to std::clog
+        std::string tile_report_path;          // If set, also write per-tile times as CSV
+
+        std::string  output_path   = "image.ppm";              // Image file; empty writes to std::cout
+        image_format output_format = image_format::automatic;  // Chosen from output_path by default
+
+        std::string checkpoint_path;              // If set, accumulated samples are saved here
+        double      checkpoint_interval = 300;    // Seconds between checkpoints
+        bool        resume              = false;  // Continue from checkpoint_path if it exists
+
+        // Adaptive sampling: samples_per_pixel becomes the maximum, and a pixel stops once the
+        // standard error of the mean luminance drops below adaptive_threshold times that mean,
+        // for the pixel and all of its neighbors.
+        bool        adaptive_sampling  = false;
+        int         adaptive_min_spp   = 16;    // Samples every pixel takes before it is tested
+        int         adaptive_batch     = 8;     // Samples taken between convergence tests
+        double      adaptive_threshold = 0.05;  // Relative standard error at which a pixel stops
+        std::string sample_heatmap_path;        // If set, write samples per pixel as an image
+
+        // With RT_STATS, the counters of a render (render_stats.h) are printed at its end while
+        // log_progress is set, and written here as JSON if set.
+        std::string stats_path;
+
+        // AOVs to collect, as aov_bit()s or'ed together. Each is written next to the image as a
+        // float map: "image.ppm" gets "image.depth.pfm" and so on. With none, the camera rays
+        // skip recording altogether.
+        uint32_t aovs = 0;
+
+        // Denoising: the image is filtered with atrous_denoiser before it is written, guided by
+        // the emission, albedo, normal and depth AOVs, which are collected while this is set.
+        bool            denoise = false;
+        denoise_options denoising;
+
+        void render(const hittable& world, const hittable_list& lights = hittable_list()) {
+            render_samples(world, lights);
+
+            auto pixels = denoise ? denoised_framebuffer() : framebuffer();
+            if (!write_image(output_path, pixels, image_width, image_height, output_format,
+                             number_of_threads))
+                std::clog << "ERROR: Could not write image '" << output_path << "'.\n";
+
+            if (!sample_heatmap_path.empty()
+                && !write_image(sample_heatmap_path, sample_heatmap(), image_width, image_height,
+                                image_format::automatic, number_of_threads))
+                std::clog << "ERROR: Could not write sample heatmap '" << sample_heatmap_path << "'.\n";
+
+            for (int i = 0; i < aov_count && !output_path.empty(); i++) {
+                auto a = aov(i);
+                if (!(aovs & aov_bit(a)))
+                    continue;
+                auto path = aov_path(a);
+                if (!write_image(path, aov_image(a), image_width, image_height, image_format::pfm,
+                                 number_of_threads))
+                    std::clog << "ERROR: Could not write AOV '" << path << "'.\n";
+            }
+        }
+
+        std::vector<color> framebuffer() const {
+            // Returns the average radiance of each pixel from the accumulated samples.
+            std::vector<color> pixels(image.size());
+            parallel_rows(image_height, number_of_threads, [&](int y0, int y1) {
+                for (int p = y0 * image_width; p < y1 * image_width; p++)
+                    pixels[p] = sample_counts[p] ? image[p] / sample_counts[p] : color(0,0,0);
+            });
+            return pixels;
+        }
+
+        std::vector<color> denoised_framebuffer() const {
+            // The framebuffer filtered by atrous_denoiser; unfiltered if the render did not
+            // collect the guides.
+            if ((aov_sums.selection() & denoise_aovs) != denoise_aovs)
+                return framebuffer();
+
+            auto start = std::chrono::steady_clock::now();
+            auto pixels = atrous_denoiser::denoise(framebuffer(), guides(), image_width, image_height,
+                                                   denoising, number_of_threads);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (log_progress)
+                std::clog << "Denoised in " << elapsed.count() << " s.\n";
+            return pixels;
+        }
+
+        denoise_guides guides() const {
+            // The AOVs the denoiser needs, and the variance of each pixel's mean luminance from
+            // its samples.
+            denoise_guides g;
+            auto pixels = sample_counts.size();
+            g.emission.resize(pixels);
+            g.albedo.resize(pixels);
+            g.normal.resize(pixels);
+            g.depth.resize(pixels);
+            g.variance.resize(pixels);
+
+            for (size_t p = 0; p < pixels; p++) {
+                g.emission[p] = aov_sums.average(aov::emission, p);
+                g.albedo[p]   = aov_sums.average(aov::albedo, p);
+                g.normal[p]   = aov_sums.average(aov::normal, p);
+                g.depth[p]    = aov_sums.average(aov::depth, p).x();
+
+                auto n = double(sample_counts[p]);
+                if (n > 1) {
+                    auto mean = luminance(image[p]) / n;
+                    auto sample_variance = std::max(0.0, luminance_sq_sums[p] / n - mean*mean) * n / (n - 1);
+                    g.variance[p] = sample_variance / n;
                 }
             }
+            return g;
+        }
+
+        std::vector<color> aov_image(aov a) const {
+            // Per pixel average of an AOV that was collected, as an image.
+            return aov_sums.image(a);
         }
 
-        void render(const hittable& world) {
+        std::string aov_path(aov a) const {
+            // output_path with the AOV's name before the extension, as a float map.
+            auto dot = output_path.find_last_of('.');
+            auto slash = output_path.find_last_of("/\\");
+            auto stem = (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+                      ? output_path : output_path.substr(0, dot);
+            return stem + "." + aov_name(a) + ".pfm";
+        }
+
+        std::vector<color> sample_heatmap() const {
+            // Samples taken per pixel relative to samples_per_pixel, from blue (none) over green
+            // to red (all of them).
+            std::vector<color> pixels(sample_counts.size());
+            for (size_t p = 0; p < pixels.size(); p++) {
+                auto t = std::min(1.0, double(sample_counts[p]) / std::max(samples_per_pixel, 1));
+                pixels[p] = color(std::max(0.0, 2*t - 1), 1 - std::fabs(2*t - 1), std::max(0.0, 1 - 2*t));
+            }
+            return pixels;
+        }
+
+        double average_samples_per_pixel() const {
+            uint64_t total = 0;
+            for (auto n : sample_counts)
+                total += n;
+            return sample_counts.empty() ? 0 : double(total) / sample_counts.size();
+        }
+
+        void render_samples(const hittable& world, const hittable_list& lights = hittable_list()) {
+            // Renders all samples into the accumulation buffer without writing any output.
             initialize();
+            sampled_lights = (sample_lights && !lights.objects.empty()) ? &lights : nullptr;
 
-            std::vector<std::thread> threads;
-            std::vector<std::vector<color>> images;
-            images.resize(number_of_threads);
+            if (resume && !checkpoint_path.empty())
+                resume_from_checkpoint();
+
+            auto tiles = make_tiles();
+            auto items = make_work_items(tiles);
+
+            work_scheduler scheduler(number_of_threads);
+            scheduler.distribute(items);
 
-            for (int i = 0; i < images.size(); i++) {
-                images[i].resize(image_width * image_height);
+            tile_report report(tiles, number_of_threads);
+            std::vector<std::mutex> tile_locks(tiles.size());
+            std::atomic<int> items_remaining(int(items.size()));
+
+            auto start = std::chrono::steady_clock::now();
+
+            // Periodically snapshot the accumulation buffers until the workers are done.
+            std::mutex checkpoint_mutex;
+            std::condition_variable workers_done;
+            bool finished = false;
+            std::thread checkpointer;
+
+            if (!checkpoint_path.empty()) {
+                checkpointer = std::thread([&] {
+                    auto interval = std::chrono::duration<double>(checkpoint_interval);
+                    std::unique_lock<std::mutex> lock(checkpoint_mutex);
+                    while (!workers_done.wait_for(lock, interval, [&] { return finished; })) {
+                        lock.unlock();
+                        save_checkpoint(tiles, tile_locks);
+                        lock.lock();
+                    }
+                });
+            }
+
+            std::vector<std::thread> threads;
+            for (int w = 0; w < number_of_threads; w++) {
                 threads.emplace_back(
-                    &camera::render_process, this, std::cref(world), std::ref(images[i])
+                    &camera::render_worker, this, std::cref(world), std::cref(tiles),
+                    std::ref(scheduler), std::ref(report), std::ref(tile_locks),
+                    std::ref(items_remaining), w
                 );
             }
 
@@ -68,27 +254,66 @@ class camera {
                 t.join();
             }
 
-            // average the pixel values and write to PPM file
-            std::cout << "P3\n" << image_width << ' ' << image_height << "\n255 \n"; // PPM Header
-            for (int p_idx = 0; p_idx < image_width * image_height; p_idx++) {
- 
-                color pixel(0,0,0);
-
-                for (const auto& img : images) {
-                    pixel += img[p_idx];
+            if (checkpointer.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+                    finished = true;
                 }
+                workers_done.notify_one();
+                checkpointer.join();
+
+                // The final state is saved too, so a later run can raise samples_per_pixel and
+                // resume from here.
+                save_checkpoint(tiles, tile_locks);
+            }
+
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+            render_seconds = wall.count();
+            sampled_lights = nullptr;
 
-                write_color(std::cout, pixel_samples_scale * pixel);
+            if (log_progress) {
+                std::clog << "\rDone.                     \n";
+                if (adaptive_sampling)
+                    std::clog << "Average samples per pixel: " << average_samples_per_pixel()
+                              << " of " << samples_per_pixel << '\n';
             }
-            std::clog << "\rDone.                     \n";
+
+            if (report_tile_times)
+                report.print(std::clog, scheduler, wall.count());
+            if (!tile_report_path.empty() && !report.write_csv(tile_report_path))
+                std::clog << "ERROR: Could not write tile report '" << tile_report_path << "'.\n";
+            if (render_stats_enabled)
+                report_counters();
+        }
+
+        int    height()         const { return image_height; }
+        double last_render_time() const { return render_seconds; }  // Wall seconds of last render
+
+        // Counters of the last render, with RT_STATS (all 0 without)
+        const render_counters& last_render_counters() const { return counters; }
+
+        double average_path_length() const {
+            // Rays traced per sample in the last render, camera rays included.
+            return rendered_samples ? double(traced_rays) / rendered_samples : 0;
         }
 
     private:
-        std::vector<color> image;
-        int samples_per_thread;
+        std::vector<color>    image;          // Sum of all samples taken for each pixel
+        std::vector<uint32_t> sample_counts;  // Number of samples taken for each pixel
+        std::vector<double>   luminance_sq_sums;  // Sum of squared sample luminance for each pixel
+        aov_buffers           aov_sums;           // Selected AOVs of each pixel
+        uint32_t generation = 0;              // Times this render was resumed from a checkpoint
+        double render_seconds = 0;
+        uint64_t traced_rays = 0;       // Rays traced in the last render
+        uint64_t rendered_samples = 0;  // Samples taken in the last render
+        render_counters counters;       // Of the last render, with RT_STATS
+        const hittable_list* sampled_lights = nullptr;  // During a render with light sampling
+
+        // The AOVs the denoiser is guided by
+        static constexpr uint32_t denoise_aovs = aov_bit(aov::depth) | aov_bit(aov::normal)
+                                               | aov_bit(aov::albedo) | aov_bit(aov::emission);
 
         int    image_height;        // Render image height in pixel count
-        double pixel_samples_scale; // Color scale factor for a sum of pixel samples
         point3 center;              // Camera center
         point3 pixel00_loc;         // Location of pixel 0,0
         vec3   pixel_delta_u;       // Offest to pixel to the right
@@ -101,13 +326,18 @@ class camera {
             image_height = int(image_width / aspect_ratio);
             image_height = (image_height < 1) ? 1 : image_height; //clamp to height of 1 pixel
 
-            image.resize(image_width * image_height);
-
-            // Will divide the given sample per pixel to the closest integer multiple 
-            // of the number of threads
-            samples_per_thread = int(samples_per_pixel / number_of_threads);
+            image.assign(image_width * image_height, color(0,0,0));
+            sample_counts.assign(image_width * image_height, 0);
+            luminance_sq_sums.assign(image_width * image_height, 0);
+            aov_sums.reset(aovs | (denoise ? denoise_aovs : 0), size_t(image_width) * image_height);
+            generation = 0;
+            traced_rays = 0;
+            counters = render_counters();
+            take_build_counters();
+            rendered_samples = 0;
 
-            pixel_samples_scale = 1.0 / samples_per_pixel;
+            number_of_threads = (number_of_threads < 1) ? 1 : number_of_threads;
+            tile_size = (tile_size < 1) ? 1 : tile_size;
 
             center = lookfrom;
 
@@ -142,6 +372,501 @@ class camera {
             defocus_disk_v = v * defocus_radius;
         }
 
+        std::vector<render_tile> make_tiles() const {
+            std::vector<render_tile> tiles;
+            for (int y = 0; y < image_height; y += tile_size) {
+                for (int x = 0; x < image_width; x += tile_size) {
+                    tiles.push_back({
+                        x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)
+                    });
+                }
+            }
+            return tiles;
+        }
+
+        std::vector<work_item> make_work_items(const std::vector<render_tile>& tiles) const {
+            // Split each tile's samples into ranges of samples_per_task, so that a few expensive
+            // tiles can still be spread across several workers. Samples that a resumed
+            // checkpoint already holds are skipped. Adaptive sampling decides per pixel how many
+            // samples to take, which needs a single item per tile.
+            auto step = (samples_per_task > 0 && !adaptive_sampling) ? samples_per_task : samples_per_pixel;
+
+            std::vector<work_item> items;
+            for (int t = 0; t < int(tiles.size()); t++) {
+                int done = samples_per_pixel;
+                for (int j = tiles[t].y0; j < tiles[t].y1; j++)
+                    for (int i = tiles[t].x0; i < tiles[t].x1; i++)
+                        done = std::min(done, int(sample_counts[i + j*image_width]));
+
+                for (int s = done; s < samples_per_pixel; s += step)
+                    items.push_back({t, s, std::min(s + step, samples_per_pixel)});
+            }
+            return items;
+        }
+
+        void resume_from_checkpoint() {
+            render_checkpoint checkpoint;
+            if (!checkpoint.load(checkpoint_path)) {
+                std::clog << "No checkpoint at '" << checkpoint_path << "', starting a new render.\n";
+                return;
+            }
+
+            if (checkpoint.width != image_width || checkpoint.height != image_height
+                || checkpoint.seed != seed) {
+                std::clog << "Checkpoint '" << checkpoint_path << "' is from a different render ("
+                          << checkpoint.width << 'x' << checkpoint.height << ", seed "
+                          << checkpoint.seed << "), starting a new render.\n";
+                return;
+            }
+
+            image = std::move(checkpoint.sums);
+            sample_counts = std::move(checkpoint.counts);
+            luminance_sq_sums = std::move(checkpoint.luminance_sq_sums);
+
+            // New samples get a fresh set of random streams, as the sample indices of ranges
+            // that were in flight when the checkpoint was taken are reused.
+            generation = checkpoint.generation + 1;
+
+            if (log_progress)
+                std::clog << "Resumed from '" << checkpoint_path << "' at "
+                          << average_samples_per_pixel() << " samples per pixel.\n";
+        }
+
+        void save_checkpoint(const std::vector<render_tile>& tiles, std::vector<std::mutex>& tile_locks) {
+            // Copy tile by tile under the tile locks, so that every pixel's sum and count match,
+            // then write the file without holding up the workers.
+            render_checkpoint checkpoint;
+            checkpoint.width = image_width;
+            checkpoint.height = image_height;
+            checkpoint.seed = seed;
+            checkpoint.generation = generation;
+            checkpoint.sums.resize(image.size());
+            checkpoint.counts.resize(image.size());
+            checkpoint.luminance_sq_sums.resize(image.size());
+
+            for (size_t t = 0; t < tiles.size(); t++) {
+                std::lock_guard<std::mutex> lock(tile_locks[t]);
+                for (int j = tiles[t].y0; j < tiles[t].y1; j++) {
+                    for (int i = tiles[t].x0; i < tiles[t].x1; i++) {
+                        checkpoint.sums[i + j*image_width] = image[i + j*image_width];
+                        checkpoint.counts[i + j*image_width] = sample_counts[i + j*image_width];
+                        checkpoint.luminance_sq_sums[i + j*image_width] = luminance_sq_sums[i + j*image_width];
+                    }
+                }
+            }
+
+            if (!checkpoint.save(checkpoint_path))
+                std::clog << "ERROR: Could not write checkpoint '" << checkpoint_path << "'.\n";
+        }
+
+        void render_worker(
+            const hittable& world, const std::vector<render_tile>& tiles, work_scheduler& scheduler,
+            tile_report& report, std::vector<std::mutex>& tile_locks,
+            std::atomic<int>& items_remaining, int worker
+        ) {
+            // Samples of the current work item, accumulated apart from the shared buffers.
+            std::vector<color>    tile_sums;
+            std::vector<double>   tile_luminance_sq;
+            std::vector<uint32_t> tile_counts;
+            aov_buffers           tile_aovs;
+            wavefront_queues      queues;
+            work_item item;
+            uint64_t rays = 0;     // Traced by this worker, added to traced_rays at the end
+            uint64_t samples = 0;
+
+            auto stream_seed = generation ? hash_seed(seed, generation) : seed;
+            thread_counters() = render_counters();
+
+            while (scheduler.next(worker, item)) {
+                auto start = std::chrono::steady_clock::now();
+                const auto& tile = tiles[item.tile];
+
+                // Seeding per work item rather than per worker keeps the image independent of
+                // which worker ended up rendering (or stealing) the item.
+                seed_random(hash_seed(stream_seed, item.tile, item.sample_begin));
+                auto tile_width = tile.x1 - tile.x0;
+                auto tile_pixels = size_t(tile_width) * (tile.y1 - tile.y0);
+
+                tile_sums.assign(tile_pixels, color(0,0,0));
+                tile_luminance_sq.assign(tile_pixels, 0);
+                tile_counts.assign(tile_pixels, 0);
+                tile_aovs.reset(aov_sums.selection(), tile_pixels);
+                auto aovs_of_tile = tile_aovs.empty() ? nullptr : &tile_aovs;
+
+                if (adaptive_sampling) {
+                    sample_tile_adaptive(world, tile, tile_sums, tile_luminance_sq, tile_counts,
+                                         aovs_of_tile, rays);
+                } else if (wavefront) {
+                    sample_tile_wavefront(world, tile, item.sample_end - item.sample_begin,
+                                          tile_sums, tile_luminance_sq, tile_counts, aovs_of_tile,
+                                          queues, rays);
+                } else {
+                    for (int j = tile.y0; j < tile.y1; j++) {
+                        for (int i = tile.x0; i < tile.x1; i++) {
+                            auto t = (i - tile.x0) + (j - tile.y0)*tile_width;
+                            sample_pixel(world, i, j, item.sample_end - item.sample_begin,
+                                         tile_sums[t], tile_luminance_sq[t], tile_counts[t],
+                                         aovs_of_tile, t, rays);
+                        }
+                    }
+                }
+                for (auto n : tile_counts)
+                    samples += n;
+
+                // Other sample ranges of this tile may finish on other workers at the same time.
+                {
+                    std::lock_guard<std::mutex> lock(tile_locks[item.tile]);
+                    for (int j = tile.y0; j < tile.y1; j++) {
+                        for (int i = tile.x0; i < tile.x1; i++) {
+                            auto t = (i - tile.x0) + (j - tile.y0)*tile_width;
+                            auto p = i + j*image_width;
+                            image[p] += tile_sums[t];
+                            luminance_sq_sums[p] += tile_luminance_sq[t];
+                            sample_counts[p] += tile_counts[t];
+                            if (!tile_aovs.empty())
+                                aov_sums.add(p, tile_aovs, t, uint32_t(item.sample_begin));
+                        }
+                    }
+                }
+
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                report.record(worker, item.tile, elapsed.count());
+
+                /*log progress*/
+                auto remaining = --items_remaining;
+                if (log_progress && remaining % 64 == 0) {
+                    static std::mutex log_mutex;
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    std::clog << "\rWork items remaining: " << remaining << "    " << std::flush;
+                }
+            }
+
+            static std::mutex totals_mutex;
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            traced_rays += rays;
+            rendered_samples += samples;
+            counters.add(thread_counters());
+        }
+
+        void take_build_counters() {
+            // The BVHs are built on the thread that builds the scene, before the render, so their
+            // counts are taken from the calling thread here rather than from the workers. They are
+            // cleared so the next render only reports the BVHs built since this one.
+            auto& caller = thread_counters();
+            counters.bvh_builds = caller.bvh_builds;
+            counters.bvh_build_seconds = caller.bvh_build_seconds;
+            caller.bvh_builds = 0;
+            caller.bvh_build_seconds = 0;
+        }
+
+        void report_counters() const {
+            if (log_progress) {
+                std::clog << "Counters of the render:\n";
+                counters.print(std::clog);
+            }
+            if (!stats_path.empty()) {
+                std::ofstream out(stats_path);
+                counters.write_json(out);
+                if (!out)
+                    std::clog << "ERROR: Could not write counters '" << stats_path << "'.\n";
+            }
+        }
+
+        void sample_pixel(
+            const hittable& world, int i, int j, int sample_count,
+            color& sum, double& luminance_sq, uint32_t& count, aov_buffers* aovs, size_t aov_pixel,
+            uint64_t& traced
+        ) const {
+            auto add = [&](const color& c) {
+                auto l = luminance(c);
+                sum += c;
+                luminance_sq += l*l;
+            };
+
+            if (packet_size > 1 && max_depth > 0) {
+                // The samples of one pixel are the most coherent rays there are, so they make up
+                // the packets. Only the camera rays are traced as a packet; bounces are traced alone.
+                ray_packet rays;
+                packet_hits hits;
+                ray camera_rays[ray_packet::max_size];
+                auto lanes = std::min(packet_size, int(ray_packet::max_size));
+
+                for (int first = 0; first < sample_count; first += lanes) {
+                    rays.size = std::min(lanes, sample_count - first);
+                    for (int lane = 0; lane < rays.size; lane++) {
+                        camera_rays[lane] = get_ray(i, j);
+                        rays.set(lane, camera_rays[lane], interval(0.001, infinity));
+                    }
+
+                    auto hit_mask = world.hit_packet(rays, rays.all(), hits);
+                    traced += rays.size;
+                    RT_COUNT_N(rays_by_depth[0], rays.size);
+                    for (int lane = 0; lane < rays.size; lane++) {
+                        auto hit = (hit_mask & (1u << lane)) != 0;
+                        if (aovs)
+                            aovs->record(aov_pixel, camera_rays[lane], hit ? &hits.rec[lane] : nullptr, background);
+                        if (!hit)
+                            RT_COUNT(path_ends[int(path_end::missed)]);
+                        add(hit ? shade(camera_rays[lane], hits.rec[lane], max_depth, world, traced) : background);
+                    }
+                }
+            } else {
+                for (int sample = 0; sample < sample_count; sample++) {
+                    ray r = get_ray(i, j);
+                    add(ray_color(r, max_depth, world, aovs, aov_pixel, traced));
+                }
+            }
+            count += sample_count;
+        }
+
+        void sample_tile_wavefront(
+            const hittable& world, const render_tile& tile, int sample_count,
+            std::vector<color>& sums, std::vector<double>& luminance_sq, std::vector<uint32_t>& counts,
+            aov_buffers* aovs, wavefront_queues& queues, uint64_t& traced
+        ) const {
+            /* Traces sample_count samples of every pixel in the tile as streams of paths. Each
+               bounce intersects all live paths of a stream, adds the background to those that
+               missed, then shades the hits one material kind at a time and compacts the paths that
+               scattered for the next bounce. The result matches ray_color(): a path still alive
+               after max_depth bounces adds nothing more. */
+            auto tile_width = tile.x1 - tile.x0;
+            auto tile_pixels = tile_width * (tile.y1 - tile.y0);
+            auto& paths = queues.paths;
+
+            // The tile's pixels go in batches of about wavefront_batch paths, which keeps the
+            // queues in cache.
+            auto pixels_per_batch = std::max(1, wavefront_batch / std::max(sample_count, 1));
+
+            for (int first = 0; first < tile_pixels; first += pixels_per_batch) {
+                paths.clear();
+                for (int t = first; t < std::min(first + pixels_per_batch, tile_pixels); t++) {
+                    auto i = tile.x0 + t % tile_width;
+                    auto j = tile.y0 + t / tile_width;
+                    for (int sample = 0; sample < sample_count; sample++)
+                        paths.push_back({get_ray(i, j), color(1,1,1), color(0,0,0), uint32_t(t), 0});
+                    counts[t] += sample_count;
+                }
+                trace_wavefront(world, queues, sums, luminance_sq, aovs, traced);
+            }
+        }
+
+        void trace_wavefront(
+            const hittable& world, wavefront_queues& queues,
+            std::vector<color>& sums, std::vector<double>& luminance_sq, aov_buffers* aovs,
+            uint64_t& traced
+        ) const {
+            auto& paths = queues.paths;
+
+            auto finish = [&](const wavefront_path& path) {
+                auto l = luminance(path.radiance);
+                sums[path.pixel] += path.radiance;
+                luminance_sq[path.pixel] += l*l;
+            };
+
+            for (int depth = 0; depth < max_depth && !paths.empty(); depth++) {
+                queues.begin_bounce();
+                traced += paths.size();
+                RT_COUNT_N(rays_by_depth[render_counters::depth_slot(depth)], paths.size());
+                auto& hits = queues.hits;
+                auto& alive = queues.alive;
+
+                if (depth == 0 && packet_size > 1) {
+                    // Camera rays of one pixel sit next to each other in the stream, so consecutive
+                    // paths make coherent packets, as in sample_pixel().
+                    ray_packet rays;
+                    packet_hits packet;
+                    auto lanes = std::min(packet_size, int(ray_packet::max_size));
+
+                    for (size_t first = 0; first < paths.size(); first += lanes) {
+                        rays.size = int(std::min(size_t(lanes), paths.size() - first));
+                        for (int lane = 0; lane < rays.size; lane++)
+                            rays.set(lane, paths[first + lane].r, interval(0.001, infinity));
+
+                        auto hit_mask = world.hit_packet(rays, rays.all(), packet);
+                        for (int lane = 0; lane < rays.size; lane++) {
+                            if (hit_mask & (1u << lane)) {
+                                hits[first + lane] = packet.rec[lane];
+                                alive[first + lane] = 1;
+                            }
+                        }
+                    }
+                } else {
+                    for (size_t k = 0; k < paths.size(); k++)
+                        alive[k] = world.hit(paths[k].r, interval(0.001, infinity), hits[k]);
+                }
+
+                if (depth == 0 && aovs) {
+                    for (size_t k = 0; k < paths.size(); k++)
+                        aovs->record(paths[k].pixel, paths[k].r, alive[k] ? &hits[k] : nullptr, background);
+                }
+
+                for (size_t k = 0; k < paths.size(); k++) {
+                    if (!alive[k]) {
+                        paths[k].radiance += paths[k].throughput * background;
+                        RT_COUNT(path_ends[int(path_end::missed)]);
+                    }
+                }
+
+                queues.bin_by_material();
+                auto last_bounce = depth + 1 >= max_depth;
+                scatter_bin<lambertian>(queues, material_kind::lambertian, world, last_bounce, traced);
+                scatter_bin<metal>(queues, material_kind::metal, world, last_bounce, traced);
+                scatter_bin<dielectric>(queues, material_kind::dielectric, world, last_bounce, traced);
+                scatter_bin<isotropic>(queues, material_kind::isotropic, world, last_bounce, traced);
+
+                // Lights emit and absorb; no other material emits.
+                auto lights = queues.bin_data(material_kind::diffuse_light);
+                for (size_t b = 0; b < queues.bin_size(material_kind::diffuse_light); b++) {
+                    auto k = lights[b];
+                    const auto& rec = hits[k];
+                    auto light = static_cast<const diffuse_light*>(rec.mat);
+                    auto emitted = light->emitted(rec.u, rec.v, rec.p);
+                    if (paths[k].scatter_pdf > 0)
+                        emitted = emitted * emission_weight(paths[k].r, paths[k].scatter_pdf);
+                    paths[k].radiance += paths[k].throughput * emitted;
+                    alive[k] = 0;
+                    RT_COUNT(scatters[size_t(material_kind::diffuse_light)]);
+                    RT_COUNT(path_ends[int(path_end::light)]);
+                }
+
+                if (!last_bounce) {
+                    for (size_t k = 0; k < paths.size(); k++) {
+                        if (alive[k] && !survives_roulette(paths[k].throughput, depth + 1)) {
+                            alive[k] = 0;
+                            RT_COUNT(path_ends[int(path_end::roulette)]);
+                        }
+                    }
+                }
+
+                queues.compact(finish);
+            }
+
+            // Paths that ran out of bounces keep what they gathered.
+            RT_COUNT_N(path_ends[int(path_end::max_depth)], paths.size());
+            for (const auto& path : paths)
+                finish(path);
+            paths.clear();
+        }
+
+        template <typename Material>
+        void scatter_bin(
+            wavefront_queues& queues, material_kind kind, const hittable& world, bool last_bounce,
+            uint64_t& traced
+        ) const {
+            // Scatters every path in the bin of one material kind, calling the final class
+            // directly, with a shadow ray per hit as in shade(). Paths that are absorbed
+            // end here.
+            auto bin = queues.bin_data(kind);
+            for (size_t b = 0; b < queues.bin_size(kind); b++) {
+                auto k = bin[b];
+                auto& path = queues.paths[k];
+                const auto& rec = queues.hits[k];
+
+                color attenuation;
+                ray scattered;
+                RT_COUNT(scatters[size_t(kind)]);
+                if (!static_cast<const Material*>(rec.mat)->scatter(path.r, rec, attenuation, scattered)) {
+                    queues.alive[k] = 0;
+                    RT_COUNT(path_ends[int(path_end::absorbed)]);
+                    continue;
+                }
+
+                path.scatter_pdf = 0;
+                if (!last_bounce && sampled_lights && rec.mat->has_pdf()) {
+                    path.radiance += path.throughput * sample_light(path.r, rec, world, traced);
+                    path.scatter_pdf = rec.mat->pdf(path.r, rec, scattered.direction());
+                }
+
+                path.throughput = path.throughput * attenuation;
+                path.r = scattered;
+            }
+        }
+
+        void sample_tile_adaptive(
+            const hittable& world, const render_tile& tile,
+            std::vector<color>& sums, std::vector<double>& luminance_sq, std::vector<uint32_t>& counts,
+            aov_buffers* aovs, uint64_t& traced
+        ) const {
+            /* Samples the tile in passes: first every pixel up to adaptive_min_spp, then batches of
+               adaptive_batch for the pixels that have not converged yet. A pixel only stops once
+               its whole 3x3 neighborhood has converged, which keeps pixels that happened to see
+               nothing but black (like a rarely hit light) from stopping early.
+
+               The tile is the only work item writing these pixels, so the samples that earlier
+               renders left in the shared buffers can be read without the tile lock. */
+            auto tile_width = tile.x1 - tile.x0;
+            auto tile_height = tile.y1 - tile.y0;
+            auto minimum = std::min(adaptive_min_spp, samples_per_pixel);
+            auto batch = std::max(adaptive_batch, 1);
+
+            std::vector<double> error(sums.size());
+            std::vector<char> active(sums.size(), 1);
+
+            for (bool first_pass = true; ; first_pass = false) {
+                bool any_active = false;
+
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++) {
+                        auto t = (i - tile.x0) + (j - tile.y0)*tile_width;
+                        if (!active[t])
+                            continue;
+
+                        auto taken = int(sample_counts[i + j*image_width] + counts[t]);
+                        auto count = first_pass ? minimum - taken : batch;
+                        count = std::min(count, samples_per_pixel - taken);
+                        if (count > 0) {
+                            sample_pixel(world, i, j, count, sums[t], luminance_sq[t], counts[t],
+                                         aovs, t, traced);
+                            any_active = true;
+                        }
+                    }
+                }
+
+                if (!any_active && !first_pass)
+                    return;
+
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++) {
+                        auto t = (i - tile.x0) + (j - tile.y0)*tile_width;
+                        error[t] = relative_error(i + j*image_width, sums[t], luminance_sq[t], counts[t]);
+                    }
+                }
+
+                for (int y = 0; y < tile_height; y++) {
+                    for (int x = 0; x < tile_width; x++) {
+                        auto t = x + y*tile_width;
+                        auto p = (tile.x0 + x) + (tile.y0 + y)*image_width;
+                        if (int(sample_counts[p] + counts[t]) >= samples_per_pixel) {
+                            active[t] = 0;
+                            continue;
+                        }
+
+                        double neighborhood_error = 0;
+                        for (int ny = std::max(y-1, 0); ny <= std::min(y+1, tile_height-1); ny++)
+                            for (int nx = std::max(x-1, 0); nx <= std::min(x+1, tile_width-1); nx++)
+                                neighborhood_error = std::max(neighborhood_error, error[nx + ny*tile_width]);
+
+                        active[t] = neighborhood_error > adaptive_threshold;
+                    }
+                }
+            }
+        }
+
+        double relative_error(int p, const color& sum, double luminance_sq, uint32_t count) const {
+            /* Standard error of the pixel's mean luminance relative to that mean, over the samples
+               of earlier renders plus those of the current work item. Dark pixels are measured
+               against a small floor rather than their own mean. */
+            auto n = double(sample_counts[p] + count);
+            if (n < 2)
+                return infinity;
+
+            auto mean = luminance(image[p] + sum) / n;
+            auto mean_sq = (luminance_sq_sums[p] + luminance_sq) / n;
+            auto variance = std::max(0.0, mean_sq - mean*mean) * n / (n - 1);
+
+            return std::sqrt(variance / n) / std::max(mean, 1e-3);
+        }
+
         ray get_ray(int i, int j) const {
             /*Construct a camera ray originating from the defocus disk and directed at the randomly
               sampled point around the pixel location i, j.*/
@@ -169,27 +894,136 @@ class camera {
             return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world) const {
+        color ray_color(
+            const ray& r, int depth, const hittable& world, aov_buffers* aovs, size_t aov_pixel,
+            uint64_t& traced
+        ) const {
             if (depth <= 0) {
                 return color(0,0,0);
             }
 
             hit_record rec;
+            traced++;
+            RT_COUNT(rays_by_depth[0]);
 
-            if (!world.hit(r, interval(0.001, infinity), rec)) 
+            auto hit = world.hit(r, interval(0.001, infinity), rec);
+            if (aovs)
+                aovs->record(aov_pixel, r, hit ? &rec : nullptr, background);
+            if (!hit) {
+                RT_COUNT(path_ends[int(path_end::missed)]);
                 return background;
+            }
+
+            return shade(r, rec, depth, world, traced);
+        }
+
+        color shade(const ray& r, const hit_record& rec, int depth, const hittable& world, uint64_t& traced) const {
+            /* Color seen along r, which hit the scene at rec. The path is followed in a loop that
+               carries its throughput (the product of the attenuations so far) rather than by
+               recursion: every bounce adds throughput times what it emits, and the path ends
+               when a material absorbs it, it leaves the scene, depth bounces are used up or
+               Russian roulette ends it.
+
+               With light sampling, hits on materials with a density add the light of a shadow ray
+               as well, so light that the next hit emits is weighted by scatter_pdf, the density
+               with which the bounce picked the direction that found it (0 after mirror and glass
+               bounces, which no shadow ray could have found). */
+            color radiance(0,0,0);
+            color throughput(1,1,1);
+            ray current = r;
+            hit_record current_rec = rec;
+            double scatter_pdf = 0;
+
+            for (int bounce = 1; ; bounce++) {
+                ray scattered;
+                color attenuation;
+                auto emitted = current_rec.mat->emitted(current_rec.u, current_rec.v, current_rec.p);
+                if (scatter_pdf > 0 && emitted.length_squared() > 0)
+                    emitted = emitted * emission_weight(current, scatter_pdf);
+                radiance += throughput * emitted;
 
-            ray scattered;
-            color attenuation;
-            color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+                if (!current_rec.mat->scatter(current, current_rec, attenuation, scattered)) {
+                    RT_COUNT(path_ends[int(current_rec.mat->kind() == material_kind::diffuse_light
+                                           ? path_end::light : path_end::absorbed)]);
+                    return radiance;
+                }
+
+                // A shadow ray from the last hit would stand for a bounce the path cannot take.
+                scatter_pdf = 0;
+                if (bounce < depth && sampled_lights && current_rec.mat->has_pdf()) {
+                    radiance += throughput * sample_light(current, current_rec, world, traced);
+                    scatter_pdf = current_rec.mat->pdf(current, current_rec, scattered.direction());
+                }
 
-            if (!rec.mat->scatter(r, rec, attenuation, scattered))
-                return color_from_emission;
+                throughput = throughput * attenuation;
+                if (bounce >= depth) {
+                    RT_COUNT(path_ends[int(path_end::max_depth)]);
+                    return radiance;
+                }
+                if (!survives_roulette(throughput, bounce)) {
+                    RT_COUNT(path_ends[int(path_end::roulette)]);
+                    return radiance;
+                }
+
+                current = scattered;
+                traced++;
+                RT_COUNT(rays_by_depth[render_counters::depth_slot(bounce)]);
+                if (!world.hit(current, interval(0.001, infinity), current_rec)) {
+                    RT_COUNT(path_ends[int(path_end::missed)]);
+                    return radiance + throughput * background;
+                }
+            }
+        }
+
+        color sample_light(const ray& r_in, const hit_record& rec, const hittable& world, uint64_t& traced) const {
+            /* Light reaching a hit through a shadow ray towards a random point of a random light,
+               weighted for MIS: the material's BSDF times cosine for that direction over the
+               light's density. Whatever the shadow ray hits first is what it sees, so a blocked
+               light adds nothing and a different light in the way adds its own emission, which
+               the density of the whole list accounts for. */
+            hittable_pdf light_pdf(*sampled_lights, rec.p);
+            auto direction = light_pdf.generate();
+            auto light_density = light_pdf.value(direction);
+            if (light_density <= 0)
+                return color(0,0,0);
+
+            auto f = rec.mat->eval(r_in, rec, direction);
+            if (f.length_squared() == 0)
+                return color(0,0,0);
+
+            hit_record light_rec;
+            traced++;
+            RT_COUNT(shadow_rays);
+            if (!world.hit(ray(rec.p, direction, r_in.time()), interval(0.001, infinity), light_rec))
+                return color(0,0,0);
+
+            auto emitted = light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+            auto scatter_density = rec.mat->pdf(r_in, rec, direction);
+            return f * emitted * (power_heuristic(light_density, scatter_density) / light_density);
+        }
+
+        double emission_weight(const ray& r, double scatter_pdf) const {
+            // MIS weight of light found by a bounce (with density scatter_pdf) along r.
+            return power_heuristic(scatter_pdf, sampled_lights->pdf_value(r.origin(), r.direction()));
+        }
+
+        static double power_heuristic(double pdf, double other_pdf) {
+            return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+        }
 
+        bool survives_roulette(color& throughput, int bounce) const {
+            // Decides whether a path that has made bounce bounces goes on, and if so weights its
+            // throughput by one over the chance it had.
+            if (!russian_roulette || bounce < roulette_depth)
+                return true;
 
-            color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
+            auto survival = std::min(roulette_max_survival,
+                                     std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+            if (random_double() >= survival)
+                return false;
 
-            return color_from_emission + color_from_scatter;
+            throughput = throughput / survival;
+            return true;
         }
 };
 
@@ -0,0 +1,133 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class render_checkpoint {
+    /* The accumulated state of a render: per pixel mean radiance, mean squared luminance (for
+       adaptive sampling) and sample count. Stored as a compact binary file (in native byte
+       order) so that a killed render can pick up where it stopped instead of starting over.
+
+       Layout: "RTCKPT" magic, version, width, height, seed, generation, then for every pixel
+       three 32-bit floats of mean radiance, a 32-bit float of mean squared luminance and a 32-bit
+       sample count. The mean rather than the sum is stored, since it keeps its precision as
+       float at any sample count. */
+    public:
+        int      width      = 0;
+        int      height     = 0;
+        uint64_t seed       = 0;
+        uint32_t generation = 0;  // Number of times the render has been resumed
+
+        std::vector<color>    sums;    // Sum of all samples of each pixel
+        std::vector<double>   luminance_sq_sums;  // Sum of squared sample luminance of each pixel
+        std::vector<uint32_t> counts;  // Number of samples of each pixel
+
+        bool save(const std::string& path) const {
+            // Written to a temporary file first, so that a crash while saving never destroys the
+            // previous checkpoint.
+            auto temp_path = path + ".tmp";
+            {
+                std::ofstream file(temp_path, std::ios::binary);
+                if (!file)
+                    return false;
+
+                file.write(magic, sizeof(magic));
+                write_value(file, version);
+                write_value(file, int32_t(width));
+                write_value(file, int32_t(height));
+                write_value(file, seed);
+                write_value(file, generation);
+
+                std::vector<char> data(sums.size() * pixel_bytes);
+                for (size_t p = 0; p < sums.size(); p++) {
+                    auto scale = counts[p] ? 1.0 / counts[p] : 0.0;
+                    float mean[3] = {
+                        float(sums[p].x() * scale), float(sums[p].y() * scale), float(sums[p].z() * scale)
+                    };
+                    float mean_luminance_sq = float(luminance_sq_sums[p] * scale);
+                    std::memcpy(&data[p * pixel_bytes], mean, sizeof(mean));
+                    std::memcpy(&data[p * pixel_bytes + sizeof(mean)], &mean_luminance_sq, sizeof(float));
+                    std::memcpy(&data[p * pixel_bytes + sizeof(mean) + sizeof(float)], &counts[p], sizeof(uint32_t));
+                }
+                file.write(data.data(), data.size());
+
+                if (!file)
+                    return false;
+            }
+
+            // rename() replaces the old checkpoint in one step on POSIX. Where it refuses to
+            // replace an existing file (Windows), the old one has to be removed first.
+            if (std::rename(temp_path.c_str(), path.c_str()) == 0)
+                return true;
+            std::remove(path.c_str());
+            return std::rename(temp_path.c_str(), path.c_str()) == 0;
+        }
+
+        bool load(const std::string& path) {
+            // Returns false if the file is missing, truncated or not a checkpoint.
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                return false;
+
+            char file_magic[sizeof(magic)];
+            uint32_t file_version;
+            int32_t file_width, file_height;
+
+            file.read(file_magic, sizeof(file_magic));
+            read_value(file, file_version);
+            read_value(file, file_width);
+            read_value(file, file_height);
+            read_value(file, seed);
+            read_value(file, generation);
+
+            if (!file || std::memcmp(file_magic, magic, sizeof(magic)) != 0 || file_version != version
+                || file_width <= 0 || file_height <= 0)
+                return false;
+
+            width = file_width;
+            height = file_height;
+
+            auto pixel_count = size_t(width) * height;
+            std::vector<char> data(pixel_count * pixel_bytes);
+            if (!file.read(data.data(), data.size()))
+                return false;
+
+            sums.resize(pixel_count);
+            luminance_sq_sums.resize(pixel_count);
+            counts.resize(pixel_count);
+            for (size_t p = 0; p < pixel_count; p++) {
+                float mean[3], mean_luminance_sq;
+                std::memcpy(mean, &data[p * pixel_bytes], sizeof(mean));
+                std::memcpy(&mean_luminance_sq, &data[p * pixel_bytes + sizeof(mean)], sizeof(float));
+                std::memcpy(&counts[p], &data[p * pixel_bytes + sizeof(mean) + sizeof(float)], sizeof(uint32_t));
+                sums[p] = double(counts[p]) * color(mean[0], mean[1], mean[2]);
+                luminance_sq_sums[p] = double(counts[p]) * mean_luminance_sq;
+            }
+
+            return true;
+        }
+
+    private:
+        static constexpr char     magic[6]    = {'R', 'T', 'C', 'K', 'P', 'T'};
+        static constexpr uint32_t version     = 2;
+        static constexpr size_t   pixel_bytes = 4 * sizeof(float) + sizeof(uint32_t);
+
+        template <typename T>
+        static void write_value(std::ofstream& file, const T& value) {
+            file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        static void read_value(std::ifstream& file, T& value) {
+            file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        }
+};
+
+#endif
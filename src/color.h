@@ -4,6 +4,15 @@
 #include "interval.h"
 #include "vec3.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
 using color = vec3;
 
 inline double linear_to_gamma(double linear_component) {
@@ -13,6 +22,11 @@ inline double linear_to_gamma(double linear_component) {
     return 0;
 }
 
+inline double luminance(const color& c) {
+    // Relative luminance of linear Rec. 709 primaries
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 void write_color(std::ostream& out, const color& pixel_color) {
     auto r = pixel_color.x();
     auto g = pixel_color.y();
@@ -33,4 +47,266 @@ void write_color(std::ostream& out, const color& pixel_color) {
     out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
 }
 
+enum class image_format {
+    automatic,  // Chosen from the output file extension; ASCII PPM when writing to std::cout
+    ppm_ascii,  // P3: 8-bit gamma corrected, human readable
+    ppm,        // P6: 8-bit gamma corrected, binary
+    pfm,        // Portable float map: 32-bit linear radiance, no clamping
+    png         // 8-bit gamma corrected RGB
+};
+
+inline image_format image_format_for_path(const std::string& path) {
+    auto ends_with = [&](const char* ext) {
+        auto n = std::strlen(ext);
+        return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+    };
+
+    if (path.empty())        return image_format::ppm_ascii;
+    if (ends_with(".pfm"))   return image_format::pfm;
+    if (ends_with(".png"))   return image_format::png;
+    return image_format::ppm;
+}
+
+inline unsigned char to_byte(double linear_component) {
+    // Gamma 2 transform, then translate the [0,1] component value to the byte range [0,255]
+    static const interval intensity(0.000, 0.999);
+    return (unsigned char)(256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
+template <typename Fn>
+void parallel_rows(int height, int threads, Fn&& fn) {
+    // Runs fn(first_row, end_row) over bands of rows, one band per thread.
+    threads = std::max(1, std::min(threads, height));
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.emplace_back([&, t] { fn(height * t / threads, height * (t+1) / threads); });
+    fn(0, height / threads);
+
+    for (auto& w : workers)
+        w.join();
+}
+
+class image_encoder {
+    /* Converts a framebuffer of linear radiance into the bytes of a complete image file. Pixel
+       conversion runs in parallel over bands of rows straight into the output buffer, so that
+       writing the image is a single write call. */
+    public:
+        image_encoder(const std::vector<color>& pixels, int width, int height, int threads = 1)
+            : pixels(pixels), width(width), height(height), threads(threads) {}
+
+        std::string encode(image_format format) const {
+            switch (format) {
+                case image_format::ppm_ascii: return encode_ppm_ascii();
+                case image_format::pfm:       return encode_pfm();
+                case image_format::png:       return encode_png();
+                default:                      return encode_ppm();
+            }
+        }
+
+    private:
+        const std::vector<color>& pixels;
+        int width, height;
+        int threads;
+
+        std::string encode_ppm_ascii() const {
+            // Every pixel takes at most 12 characters ("255 255 255\n"). Each band of rows is
+            // formatted into its own string by one thread, then the bands are joined.
+            auto band_count = std::max(1, std::min(threads, height));
+            std::vector<std::string> bands(band_count);
+
+            parallel_rows(band_count, band_count, [&](int b0, int b1) {
+                for (int b = b0; b < b1; b++) {
+                    auto y0 = height * b / band_count;
+                    auto y1 = height * (b+1) / band_count;
+                    bands[b].reserve(size_t(y1 - y0) * width * 12);
+
+                    for (int p = y0 * width; p < y1 * width; p++) {
+                        append_decimal(bands[b], to_byte(pixels[p].x()), ' ');
+                        append_decimal(bands[b], to_byte(pixels[p].y()), ' ');
+                        append_decimal(bands[b], to_byte(pixels[p].z()), '\n');
+                    }
+                }
+            });
+
+            std::string out = "P3\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+            for (const auto& band : bands)
+                out += band;
+            return out;
+        }
+
+        std::string encode_ppm() const {
+            std::string out = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+            auto header = out.size();
+            out.resize(header + size_t(3) * width * height);
+
+            auto data = reinterpret_cast<unsigned char*>(&out[header]);
+            parallel_rows(height, threads, [&](int y0, int y1) {
+                for (int p = y0 * width; p < y1 * width; p++) {
+                    data[3*p + 0] = to_byte(pixels[p].x());
+                    data[3*p + 1] = to_byte(pixels[p].y());
+                    data[3*p + 2] = to_byte(pixels[p].z());
+                }
+            });
+            return out;
+        }
+
+        std::string encode_pfm() const {
+            // A negative scale marks little-endian floats. Rows are stored bottom to top.
+            std::string out = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+            auto header = out.size();
+            out.resize(header + sizeof(float) * 3 * width * height);
+
+            auto data = &out[header];
+            parallel_rows(height, threads, [&](int y0, int y1) {
+                for (int y = y0; y < y1; y++) {
+                    auto row = data + sizeof(float) * 3 * size_t(height - 1 - y) * width;
+                    for (int x = 0; x < width; x++) {
+                        const auto& pixel = pixels[x + y*width];
+                        float rgb[3] = { float(pixel.x()), float(pixel.y()), float(pixel.z()) };
+                        store_little_endian(row + sizeof(rgb) * x, rgb);
+                    }
+                }
+            });
+            return out;
+        }
+
+        std::string encode_png() const {
+            // 8-bit RGB, every row with filter type 0. The image data is wrapped in uncompressed
+            // (stored) deflate blocks, which keeps the writer free of a zlib dependency.
+            auto row_bytes = size_t(1) + 3 * size_t(width);
+            std::string raw(row_bytes * height, '\0');
+
+            parallel_rows(height, threads, [&](int y0, int y1) {
+                for (int y = y0; y < y1; y++) {
+                    auto row = reinterpret_cast<unsigned char*>(&raw[y * row_bytes + 1]);
+                    for (int x = 0; x < width; x++) {
+                        const auto& pixel = pixels[x + y*width];
+                        row[3*x + 0] = to_byte(pixel.x());
+                        row[3*x + 1] = to_byte(pixel.y());
+                        row[3*x + 2] = to_byte(pixel.z());
+                    }
+                }
+            });
+
+            const size_t max_block = 65535;
+            std::string zlib = "\x78\x01";
+            zlib.reserve(2 + raw.size() + 5 * (raw.size() / max_block + 1) + 4);
+            for (size_t pos = 0; pos < raw.size() || pos == 0; pos += max_block) {
+                auto len = std::min(max_block, raw.size() - pos);
+                bool final_block = pos + len >= raw.size();
+                zlib += char(final_block ? 1 : 0);
+                put_u16_le(zlib, uint16_t(len));
+                put_u16_le(zlib, uint16_t(~len));
+                zlib.append(raw, pos, len);
+                if (final_block) break;
+            }
+            put_u32_be(zlib, adler32(raw));
+
+            std::string ihdr;
+            put_u32_be(ihdr, uint32_t(width));
+            put_u32_be(ihdr, uint32_t(height));
+            ihdr += std::string("\x08\x02\x00\x00\x00", 5); // 8-bit, RGB, deflate, no filter, no interlace
+
+            std::string out = "\x89PNG\r\n\x1a\n";
+            out.reserve(out.size() + zlib.size() + 64);
+            put_png_chunk(out, "IHDR", ihdr);
+            put_png_chunk(out, "IDAT", zlib);
+            put_png_chunk(out, "IEND", "");
+            return out;
+        }
+
+        static void append_decimal(std::string& out, unsigned char value, char separator) {
+            char text[4];
+            int n = 0;
+            if (value >= 100) text[n++] = char('0' + value / 100);
+            if (value >= 10)  text[n++] = char('0' + value / 10 % 10);
+            text[n++] = char('0' + value % 10);
+            text[n++] = separator;
+            out.append(text, n);
+        }
+
+        static void store_little_endian(char* dest, const float (&rgb)[3]) {
+            for (int c = 0; c < 3; c++) {
+                uint32_t bits;
+                std::memcpy(&bits, &rgb[c], sizeof(bits));
+                for (int b = 0; b < 4; b++)
+                    dest[4*c + b] = char((bits >> (8*b)) & 0xff);
+            }
+        }
+
+        static void put_u16_le(std::string& out, uint16_t v) {
+            out += char(v & 0xff);
+            out += char(v >> 8);
+        }
+
+        static void put_u32_be(std::string& out, uint32_t v) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                out += char((v >> shift) & 0xff);
+        }
+
+        static uint32_t adler32(const std::string& data) {
+            uint32_t a = 1, b = 0;
+            const size_t nmax = 5552; // Largest run before the sums must be reduced
+            for (size_t pos = 0; pos < data.size(); pos += nmax) {
+                auto end = std::min(data.size(), pos + nmax);
+                for (auto i = pos; i < end; i++) {
+                    a += (unsigned char)data[i];
+                    b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+            }
+            return (b << 16) | a;
+        }
+
+        static uint32_t crc32(const char* type, const std::string& data) {
+            static const auto table = [] {
+                std::vector<uint32_t> t(256);
+                for (uint32_t n = 0; n < 256; n++) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; k++)
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    t[n] = c;
+                }
+                return t;
+            }();
+
+            uint32_t crc = 0xffffffffu;
+            for (int i = 0; i < 4; i++)
+                crc = table[(crc ^ (unsigned char)type[i]) & 0xff] ^ (crc >> 8);
+            for (unsigned char byte : data)
+                crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+            return crc ^ 0xffffffffu;
+        }
+
+        static void put_png_chunk(std::string& out, const char* type, const std::string& data) {
+            put_u32_be(out, uint32_t(data.size()));
+            out.append(type, 4);
+            out += data;
+            put_u32_be(out, crc32(type, data));
+        }
+};
+
+inline bool write_image(
+    const std::string& path, const std::vector<color>& pixels, int width, int height,
+    image_format format = image_format::automatic, int threads = 1
+) {
+    /* Writes the linear radiance framebuffer as an image file with a single write call. An empty
+       path writes to std::cout. Returns false if the file could not be written. */
+    if (format == image_format::automatic)
+        format = image_format_for_path(path);
+
+    auto bytes = image_encoder(pixels, width, height, threads).encode(format);
+
+    if (path.empty()) {
+        std::cout.write(bytes.data(), bytes.size());
+        return bool(std::cout.flush());
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), bytes.size());
+    return bool(file);
+}
+
 #endif
\ No newline at end of file
@@ -8,14 +8,15 @@
 class constant_medium : public hittable {
     public:
         constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex)
-        : boundary(boundary), neg_inv_density(-1/density), phase_function(make_shared<isotropic>(tex))
+        : boundary(boundary), neg_inv_density(-1/density), phase_function(make_scene_object<isotropic>(tex))
         {}
 
         constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
         : boundary(boundary), neg_inv_density(-1/density),
-         phase_function(make_shared<isotropic>(albedo)) {}
+         phase_function(make_scene_object<isotropic>(albedo)) {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_COUNT(medium_tests);
             hit_record rec1, rec2;
 
             // determine depth of volume. return if no hit
@@ -49,7 +50,7 @@ class constant_medium : public hittable {
 
             rec.normal = vec3(1,0,0);  // arbitrary
             rec.front_face = true;     // also arbitrary
-            rec.mat = phase_function;
+            rec.mat = phase_function.get();
 
             return true;
         }
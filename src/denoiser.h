@@ -0,0 +1,174 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct denoise_guides {
+    // Per pixel averages of what the camera rays hit first (the emission, albedo, normal and
+    // depth AOVs), plus the variance of the pixel's mean luminance.
+    std::vector<color>  emission;
+    std::vector<color>  albedo;
+    std::vector<vec3>   normal;  // Unit length, or zero where every sample missed
+    std::vector<double> depth;
+    std::vector<double> variance;
+};
+
+struct denoise_options {
+    int    iterations      = 3;    // Filter passes; pass i takes taps 2^i pixels apart
+    double sigma_luminance = 2;    // Luminance edge stop, in standard deviations of the pixel's noise
+    double sigma_normal    = 128;  // Exponent on the cosine between two pixels' normals
+    double sigma_depth     = 1;    // Depth edge stop, relative to the local depth gradient
+    double sigma_albedo    = 0.1;  // Albedo edge stop
+};
+
+class atrous_denoiser {
+    /* Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding A-Trous Wavelet
+       Transform for fast Global Illumination Filtering", HPG 2010), with the luminance edge stop
+       scaled by each pixel's own noise as in SVGF (Schied et al., HPG 2017).
+
+       What the first hits emit (lights and background) is taken out of the image before
+       filtering and added back after, so the edges of lights stay sharp. The rest is divided by
+       the first-hit albedo, so that textures are not blurred along with the noise, and
+       multiplied back at the end. Each pass filters with a 5x5 B3-spline kernel whose taps are
+       2^i pixels apart, so three passes reach 16 pixels wide at 25 taps per pixel and pass.
+       Taps across a change of normal, depth, albedo or (beyond the noise) luminance are
+       weighted down. Rows are filtered in parallel bands. */
+    public:
+        static std::vector<color> denoise(
+            const std::vector<color>& beauty, const denoise_guides& guides, int width, int height,
+            const denoise_options& options = {}, int threads = 1
+        ) {
+            auto pixels = size_t(width) * height;
+            std::vector<color>  illumination(pixels), next(pixels);
+            std::vector<double> variance(pixels), next_variance(pixels);
+            std::vector<double> depth_gradient(pixels);
+
+            for (size_t p = 0; p < pixels; p++) {
+                auto a = demodulation_albedo(guides.albedo[p]);
+                auto reflected = beauty[p] - guides.emission[p];
+                illumination[p] = color(reflected.x() / a.x(), reflected.y() / a.y(), reflected.z() / a.z());
+                auto la = std::max(luminance(a), 1e-3);
+                variance[p] = guides.variance[p] / (la*la);
+            }
+
+            // How much the depth changes from one pixel to the next, along the smoother side on
+            // each axis so that silhouettes do not count.
+            parallel_rows(height, threads, [&](int y0, int y1) {
+                for (int y = y0; y < y1; y++) {
+                    for (int x = 0; x < width; x++) {
+                        auto z = guides.depth[x + y*width];
+                        auto along = [&](int dx, int dy) {
+                            double d = infinity;
+                            for (int s : {-1, 1}) {
+                                auto qx = x + s*dx, qy = y + s*dy;
+                                if (qx >= 0 && qx < width && qy >= 0 && qy < height)
+                                    d = std::min(d, std::fabs(guides.depth[qx + qy*width] - z));
+                            }
+                            return d == infinity ? 0.0 : d;
+                        };
+                        auto gx = along(1, 0), gy = along(0, 1);
+                        depth_gradient[x + y*width] = std::sqrt(gx*gx + gy*gy);
+                    }
+                }
+            });
+
+            for (int pass = 0; pass < options.iterations; pass++) {
+                filter_pass(illumination, variance, guides, depth_gradient, next, next_variance,
+                            width, height, 1 << pass, options, threads);
+                std::swap(illumination, next);
+                std::swap(variance, next_variance);
+            }
+
+            std::vector<color> result(pixels);
+            for (size_t p = 0; p < pixels; p++)
+                result[p] = illumination[p] * demodulation_albedo(guides.albedo[p]) + guides.emission[p];
+            return result;
+        }
+
+    private:
+        static color demodulation_albedo(const color& albedo) {
+            // Black albedo channels would blow the noise up; they are lifted a little.
+            return color(std::max(albedo.x(), 0.01), std::max(albedo.y(), 0.01), std::max(albedo.z(), 0.01));
+        }
+
+        static double blurred_variance(const std::vector<double>& variance, int x, int y, int width, int height) {
+            // The variance of a pixel is estimated from few samples, so the luminance edge stop
+            // uses a 3x3 Gaussian of it; a pixel whose samples happened to agree would otherwise
+            // refuse all its neighbors.
+            static const double kernel[3] = {1.0/4, 1.0/2, 1.0/4};
+            double sum = 0, weight_sum = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    auto qx = x + dx, qy = y + dy;
+                    if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                        continue;
+                    auto w = kernel[dx + 1] * kernel[dy + 1];
+                    sum += w * variance[qx + qy*width];
+                    weight_sum += w;
+                }
+            }
+            return std::max(sum / weight_sum, 0.0);
+        }
+
+        static void filter_pass(
+            const std::vector<color>& in, const std::vector<double>& in_variance,
+            const denoise_guides& guides, const std::vector<double>& depth_gradient,
+            std::vector<color>& out, std::vector<double>& out_variance,
+            int width, int height, int step, const denoise_options& options, int threads
+        ) {
+            static const double kernel[5] = {1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16};
+
+            parallel_rows(height, threads, [&](int y0, int y1) {
+                for (int y = y0; y < y1; y++) {
+                    for (int x = 0; x < width; x++) {
+                        auto p = x + y*width;
+                        const auto& n_p = guides.normal[p];
+                        const auto& a_p = guides.albedo[p];
+                        auto z_p = guides.depth[p];
+                        auto l_p = luminance(in[p]);
+                        auto luminance_scale = options.sigma_luminance * std::sqrt(blurred_variance(in_variance, x, y, width, height)) + 1e-6;
+                        auto depth_scale = options.sigma_depth * depth_gradient[p] * step + 1e-9;
+
+                        color sum(0,0,0);
+                        double variance_sum = 0, weight_sum = 0;
+
+                        for (int dy = -2; dy <= 2; dy++) {
+                            auto qy = y + dy*step;
+                            if (qy < 0 || qy >= height)
+                                continue;
+
+                            for (int dx = -2; dx <= 2; dx++) {
+                                auto qx = x + dx*step;
+                                if (qx < 0 || qx >= width)
+                                    continue;
+
+                                auto q = qx + qy*width;
+                                auto w = kernel[dx + 2] * kernel[dy + 2];
+                                if (q != p) {
+                                    auto w_normal = std::pow(std::max(0.0, dot(n_p, guides.normal[q])), options.sigma_normal);
+                                    auto w_depth = std::exp(-std::fabs(z_p - guides.depth[q]) / (depth_scale * std::sqrt(double(dx*dx + dy*dy))));
+                                    auto w_luminance = std::exp(-std::fabs(l_p - luminance(in[q])) / luminance_scale);
+                                    auto w_albedo = std::exp(-(a_p - guides.albedo[q]).length_squared()
+                                                             / (options.sigma_albedo * options.sigma_albedo));
+                                    w *= w_normal * w_depth * w_luminance * w_albedo;
+                                }
+
+                                sum += w * in[q];
+                                variance_sum += w*w * in_variance[q];
+                                weight_sum += w;
+                            }
+                        }
+
+                        out[p] = sum / weight_sum;
+                        out_variance[p] = variance_sum / (weight_sum * weight_sum);
+                    }
+                }
+            });
+        }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 
 #include "aabb.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -9,7 +10,7 @@ class hit_record {
     public:
         point3 p;
         vec3 normal;
-        shared_ptr<material> mat;
+        const material* mat = nullptr;  // Owned by the primitive that was hit, which the scene keeps alive
         double t;
         double u;
         double v;
@@ -23,13 +24,39 @@ class hit_record {
         }
 };
 
+struct packet_hits {
+    hit_record rec[ray_packet::max_size];  // Closest hit of each lane so far
+};
+
 class hittable {
     public:
         virtual ~hittable() = default;
 
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+        virtual uint32_t hit_packet(ray_packet& rays, uint32_t mask, packet_hits& hits) const {
+            /* Tests every lane in mask, storing hits in hits.rec and shrinking the lane's t_max to
+               the hit distance. Returns the lanes that hit. This default traces the lanes one by
+               one; hittables that can test several rays at once override it. */
+            uint32_t hit_mask = 0;
+            hit_record rec;
+            for (int lane = 0; lane < rays.size; lane++) {
+                if ((mask & (1u << lane)) && hit(rays.get(lane), rays.range(lane), rec)) {
+                    rays.t_max[lane] = rec.t;
+                    hits.rec[lane] = rec;
+                    hit_mask |= 1u << lane;
+                }
+            }
+            return hit_mask;
+        }
+
         virtual aabb bounding_box() const = 0;
+
+        // Light sampling. random() returns a direction from origin towards a random point of the
+        // object, and pdf_value() the density (per unit solid angle) with which random() picks
+        // direction. Objects that are never sampled as lights keep these defaults.
+        virtual double pdf_value(const point3& origin, const vec3& direction) const { return 0.0; }
+        virtual vec3 random(const point3& origin) const { return vec3(1, 0, 0); }
 };
 
 class translate : public hittable {
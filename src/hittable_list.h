@@ -36,8 +36,31 @@ class hittable_list : public hittable {
             return hit_anything;
         }
 
+        uint32_t hit_packet(ray_packet& rays, uint32_t mask, packet_hits& hits) const override {
+            // Each object culls against the lanes' t_max, so later objects only report closer hits.
+            uint32_t hit_mask = 0;
+            for (const auto& object : objects)
+                hit_mask |= object->hit_packet(rays, mask, hits);
+            return hit_mask;
+        }
+
         aabb bounding_box() const override { return bbox; }
 
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // random() picks one object uniformly, so the density is the average of theirs.
+            if (objects.empty())
+                return 0.0;
+
+            auto sum = 0.0;
+            for (const auto& object : objects)
+                sum += object->pdf_value(origin, direction);
+            return sum / objects.size();
+        }
+
+        vec3 random(const point3& origin) const override {
+            return objects[random_int(0, int(objects.size()) - 1)]->random(origin);
+        }
+
         private:
             aabb bbox;
 };
@@ -0,0 +1,216 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <vector>
+
+class affine_transform {
+    /* A 3x4 matrix: a linear map (rotation, scale, shear) in the first three columns followed by
+       a translation in the last one. Transforms compose right to left like matrices, so
+       translation(t) * rotation(axis, a) rotates first and then translates. */
+    public:
+        double m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+        static affine_transform translation(const vec3& offset) {
+            affine_transform t;
+            for (int row = 0; row < 3; row++)
+                t.m[row][3] = offset[row];
+            return t;
+        }
+
+        static affine_transform scaling(const vec3& factors) {
+            affine_transform t;
+            for (int row = 0; row < 3; row++)
+                t.m[row][row] = factors[row];
+            return t;
+        }
+
+        static affine_transform scaling(double factor) { return scaling(vec3(factor, factor, factor)); }
+
+        static affine_transform rotation(const vec3& axis, double angle) {
+            // Counterclockwise by angle degrees when looking down the axis towards the origin, so
+            // rotation(vec3(0,1,0), a) turns objects like rotate_y(object, a).
+            auto a = unit_vector(axis);
+            auto radians = degrees_to_radians(angle);
+            auto s = std::sin(radians), c = std::cos(radians), k = 1 - c;
+
+            affine_transform t;
+            t.m[0][0] = c + a.x()*a.x()*k;         t.m[0][1] = a.x()*a.y()*k - a.z()*s;  t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+            t.m[1][0] = a.y()*a.x()*k + a.z()*s;  t.m[1][1] = c + a.y()*a.y()*k;         t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+            t.m[2][0] = a.z()*a.x()*k - a.y()*s;  t.m[2][1] = a.z()*a.y()*k + a.x()*s;  t.m[2][2] = c + a.z()*a.z()*k;
+            return t;
+        }
+
+        affine_transform operator*(const affine_transform& b) const {
+            // This transform applied after b.
+            affine_transform t;
+            for (int row = 0; row < 3; row++) {
+                for (int col = 0; col < 4; col++) {
+                    t.m[row][col] = m[row][0]*b.m[0][col] + m[row][1]*b.m[1][col] + m[row][2]*b.m[2][col];
+                }
+                t.m[row][3] += m[row][3];
+            }
+            return t;
+        }
+
+        point3 point(const point3& p) const {
+            return point3(
+                m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]
+            );
+        }
+
+        vec3 vector(const vec3& v) const {
+            return vec3(
+                m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z()
+            );
+        }
+
+        vec3 transposed_vector(const vec3& v) const {
+            // The linear part transposed times v. Normals transform by the inverse transpose, so
+            // this on the inverse transform maps a normal from object to world space.
+            return vec3(
+                m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z()
+            );
+        }
+
+        aabb box(const aabb& b) const {
+            // The box around the transformed box (Arvo, "Transforming Axis-Aligned Bounding
+            // Boxes", Graphics Gems 1990): every output axis takes the smaller and larger
+            // product of each matrix entry with the input interval.
+            interval axes[3];
+            for (int row = 0; row < 3; row++) {
+                double lo = m[row][3], hi = m[row][3];
+                for (int col = 0; col < 3; col++) {
+                    const auto& in = b.axis_interval(col);
+                    auto e = m[row][col] * in.min;
+                    auto f = m[row][col] * in.max;
+                    lo += std::fmin(e, f);
+                    hi += std::fmax(e, f);
+                }
+                axes[row] = interval(lo, hi);
+            }
+            return aabb(axes[0], axes[1], axes[2]);
+        }
+
+        double determinant() const {
+            return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        }
+
+        affine_transform inverse() const {
+            // The linear part is inverted through its adjugate; the translation is then undone
+            // by the inverted linear part. The transform must not be singular.
+            affine_transform t;
+            auto inv_det = 1 / determinant();
+
+            t.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+            t.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+            t.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+            t.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+            t.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+            t.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+            t.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+            t.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+            t.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+            auto offset = t.vector(vec3(m[0][3], m[1][3], m[2][3]));
+            for (int row = 0; row < 3; row++)
+                t.m[row][3] = -offset[row];
+            return t;
+        }
+};
+
+class instance final : public hittable {
+    /* A placement of a shared object (usually a BVH of its own: the bottom level) under an
+       arbitrary affine transform. Only the object pointer, the transform, its cached inverse and
+       the world space box are stored, so copies cost the same however much geometry the object
+       holds. Replaces nesting translate and rotate_y, which re-wrap the ray once per level and
+       can only turn about Y. */
+    public:
+        instance(shared_ptr<hittable> object, const affine_transform& object_to_world)
+            : object(object), to_world(object_to_world), to_object(object_to_world.inverse())
+        {
+            bbox = to_world.box(object->bounding_box());
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // The direction is transformed without normalizing it, so t means the same distance
+            // along the ray in both spaces and ray_t carries over unchanged.
+            ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+
+            if (!object->hit(object_r, ray_t, rec))
+                return false;
+
+            // A normal facing against the object space ray still faces against the world space
+            // ray after the inverse transpose, so front_face is kept.
+            rec.p = r.at(rec.t);
+            rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+            return true;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        const affine_transform& transform() const { return to_world; }
+
+    private:
+        shared_ptr<hittable> object;
+        affine_transform to_world;
+        affine_transform to_object;
+        aabb bbox;
+};
+
+class instance_bvh : public hittable {
+    /* The top level: a BVH over instances, which are stored by value in leaf order. Traversal
+       calls instance::hit directly (the class is final), so only the object inside each
+       instance costs a virtual call. */
+    public:
+        instance_bvh(std::vector<instance> list, const bvh_build_options& options = {}) {
+            std::vector<aabb> bounds;
+            bounds.reserve(list.size());
+            for (const auto& inst : list)
+                bounds.push_back(inst.bounding_box());
+
+            tree.build(bounds, options);
+
+            instances.reserve(list.size());
+            for (auto index : tree.indices)
+                instances.push_back(std::move(list[index]));
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+                if (!instances[i].hit(r, t, rec))
+                    return false;
+                t.max = rec.t;
+                return true;
+            });
+        }
+
+        aabb bounding_box() const override { return tree.bounding_box(); }
+
+        size_t size() const { return instances.size(); }
+
+        const bvh_build_report& build_report() const { return tree.build_report(); }
+
+        size_t memory_bytes() const {
+            // Instances and hierarchy, not counting the shared objects they place.
+            return instances.capacity() * sizeof(instance)
+                 + tree.nodes.capacity() * sizeof(linear_bvh_node)
+                 + tree.indices.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        bvh_tree tree;
+        std::vector<instance> instances;
+};
+
+#endif
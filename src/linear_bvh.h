@@ -0,0 +1,692 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "ray_packet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct alignas(64) linear_bvh_node {
+    /* One cache line per node. Nodes are stored in depth first order, so the first child of an
+       interior node always directly follows it and only the second child needs an offset. */
+    aabb     bbox;    // 48 bytes
+    uint32_t offset;  // Leaf: first entry in the primitive index array. Interior: second child
+    uint16_t count;   // Number of primitives in a leaf, 0 for interior nodes
+    uint8_t  axis;    // Split axis of an interior node, used to order the children
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(linear_bvh_node) == 64, "linear_bvh_node should fill one cache line");
+
+enum class bvh_split_method {
+    median,  // Object median along the longest centroid axis
+    sah      // Binned surface area heuristic
+};
+
+struct bvh_build_options {
+    bvh_split_method split = bvh_split_method::sah;
+
+    int    bin_count         = 16;   // SAH bins per axis; bin_count-1 candidate planes are tested
+    int    max_leaf_size     = 4;    // Spans larger than this are always split
+    double traversal_cost    = 1.0;  // SAH cost of visiting one interior node
+    double intersection_cost = 1.0;  // SAH cost of testing one primitive
+
+    int      build_threads      = 0;      // Threads used for building, 0 = hardware concurrency
+    uint32_t parallel_threshold = 16384;  // Smallest span that is built in parallel
+};
+
+struct bvh_build_report {
+    size_t primitives    = 0;
+    size_t nodes         = 0;
+    size_t leaves        = 0;
+    int    depth         = 0;  // Depth of the deepest leaf, the root being depth 1
+    double sah_cost      = 0;  // Expected cost of a ray through the root, using the build costs
+    double build_seconds = 0;
+
+    double average_leaf_size() const { return leaves ? double(primitives) / leaves : 0; }
+
+    void print(std::ostream& out) const {
+        out << "BVH: " << primitives << " primitives, " << nodes << " nodes, " << leaves
+            << " leaves (avg " << average_leaf_size() << " prims), depth " << depth
+            << ", SAH cost " << sah_cost << ", built in " << 1000 * build_seconds << " ms\n";
+    }
+};
+
+class bvh_tree {
+    /* A flattened bounding volume hierarchy over an array of primitive bounds. The tree knows
+       nothing about the primitives themselves: leaves reference a range of the index array, and
+       traversal hands each index to a caller supplied intersection function. */
+    public:
+        std::vector<linear_bvh_node> nodes;
+        std::vector<uint32_t> indices;  // Primitive indices, grouped by leaf
+
+        static const int max_depth = 64;  // Size of the traversal stack
+
+        void build(const std::vector<aabb>& bounds, const bvh_build_options& build_options = {}) {
+            auto start_time = std::chrono::steady_clock::now();
+
+            options = build_options;
+            options.bin_count     = std::max(2, options.bin_count);
+            options.max_leaf_size = std::max(1, std::min(options.max_leaf_size, 0xffff));
+
+            nodes.clear();
+            indices.resize(bounds.size());
+            for (uint32_t i = 0; i < indices.size(); i++)
+                indices[i] = i;
+
+            report = bvh_build_report();
+            report.primitives = bounds.size();
+
+            if (!bounds.empty()) {
+                auto threads = options.build_threads > 0 ? options.build_threads
+                             : int(std::max(1u, std::thread::hardware_concurrency()));
+
+                // The builder partitions copies of the bounds and centroids along with the
+                // indices, so every pass streams through memory instead of gathering.
+                prims.resize(bounds.size());
+                parallel_chunks(threads, 0, uint32_t(bounds.size()), [&](int, uint32_t begin, uint32_t end) {
+                    for (auto i = begin; i < end; i++)
+                        prims[i] = {bounds[i], centroid(bounds[i]), i};
+                });
+
+                build_subtree root;
+                root.nodes.reserve(2 * bounds.size() / options.max_leaf_size + 1);
+                build_recursive(root, 0, uint32_t(bounds.size()), 1, threads);
+
+                for (size_t i = 0; i < prims.size(); i++)
+                    indices[i] = prims[i].index;
+
+                nodes = std::move(root.nodes);
+                nodes.shrink_to_fit();  // The reserve above is only a guess
+                prims = std::vector<build_primitive>();
+                report.leaves = root.leaves;
+                report.depth  = root.depth;
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+            report.nodes = nodes.size();
+            report.sah_cost = sah_cost();
+            report.build_seconds = elapsed.count();
+
+            RT_COUNT(bvh_builds);
+            RT_COUNT_N(bvh_build_seconds, report.build_seconds);
+        }
+
+        const aabb& bounding_box() const { return nodes.empty() ? aabb::empty : nodes[0].bbox; }
+
+        const bvh_build_report& build_report() const { return report; }
+
+        template <typename LeafHit>
+        bool traverse(const ray& r, interval ray_t, LeafHit&& leaf_hit) const {
+            /* Visit every leaf whose box the ray enters, nearest child first. leaf_hit(i, ray_t)
+               tests the primitive at position i of the index array and, on a hit, shrinks
+               ray_t.max to the hit distance so that later boxes and primitives are culled against
+               the closest hit so far. */
+            if (nodes.empty())
+                return false;
+
+            return traverse_subtree(0, r, ray_t, each_primitive(leaf_hit));
+        }
+
+        template <typename LeafHit>
+        bool traverse_leaves(const ray& r, interval ray_t, LeafHit&& leaf_hit) const {
+            /* Like traverse, but hands whole leaves to leaf_hit(first, count, ray_t), for
+               primitives that test a leaf's range of the index array at once. */
+            if (nodes.empty())
+                return false;
+
+            return traverse_subtree(0, r, ray_t, leaf_hit);
+        }
+
+        template <typename LeafHit>
+        uint32_t traverse_packet(ray_packet& rays, uint32_t mask, LeafHit&& leaf_hit) const {
+            /* Trace the lanes in mask together: each node is tested against all of them at once
+               and is entered with the lanes that hit its box. Children are ordered by the
+               direction of the first active lane, which for coherent rays holds for the rest.
+               leaf_hit(i, lanes) tests the primitive at position i against those lanes, shrinks
+               their t_max on a hit and returns the lanes it hit.
+
+               Once a subtree is entered by fewer than a quarter of the packet, the packet has
+               diverged and most of each packet test would be wasted, so the remaining lanes
+               continue through that subtree one ray at a time. */
+            if (nodes.empty() || !mask)
+                return 0;
+
+            struct entry {
+                uint32_t node;
+                uint32_t lanes;
+            };
+
+            entry stack[max_depth];
+            int stack_size = 0;
+            uint32_t node_index = 0;
+            uint32_t lanes = mask;
+            uint32_t hit_mask = 0;
+            auto min_lanes = std::max(2, rays.size / 4);
+
+            while (true) {
+                const auto& node = nodes[node_index];
+                RT_COUNT(bvh_nodes_visited);
+
+                auto active = packet_box_hit(node.bbox, rays, lanes);
+
+                if (active && lane_count(active) < min_lanes) {
+                    for (auto remaining = active; remaining; remaining &= remaining - 1) {
+                        auto lane = first_lane(remaining);
+                        auto r = rays.get(lane);
+                        auto found = traverse_subtree(node_index, r, rays.range(lane),
+                            each_primitive([&](uint32_t i, interval& ray_t) {
+                                if (!leaf_hit(i, 1u << lane))
+                                    return false;
+                                ray_t.max = rays.t_max[lane];
+                                return true;
+                            }));
+                        if (found)
+                            hit_mask |= 1u << lane;
+                    }
+                } else if (active && node.is_leaf()) {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                        hit_mask |= leaf_hit(i, active);
+                } else if (active) {
+                    auto lane = first_lane(active);
+                    const double direction[3] = { rays.dx[lane], rays.dy[lane], rays.dz[lane] };
+
+                    if (direction[node.axis] < 0) {
+                        stack[stack_size++] = {node_index + 1, active};
+                        node_index = node.offset;
+                    } else {
+                        stack[stack_size++] = {node.offset, active};
+                        node_index = node_index + 1;
+                    }
+                    lanes = active;
+                    continue;
+                }
+
+                if (stack_size == 0) break;
+                --stack_size;
+                node_index = stack[stack_size].node;
+                lanes = stack[stack_size].lanes;
+            }
+
+            return hit_mask;
+        }
+
+        static point3 centroid(const aabb& box) {
+            return point3(
+                0.5 * (box.x.min + box.x.max),
+                0.5 * (box.y.min + box.y.max),
+                0.5 * (box.z.min + box.z.max)
+            );
+        }
+
+    private:
+        template <typename PrimitiveHit>
+        static auto each_primitive(PrimitiveHit&& primitive_hit) {
+            // Turns a per primitive hit function into a per leaf one.
+            return [&primitive_hit](uint32_t first, uint32_t count, interval& ray_t) {
+                bool hit_anything = false;
+                for (uint32_t i = first; i < first + count; i++) {
+                    if (primitive_hit(i, ray_t))
+                        hit_anything = true;
+                }
+                return hit_anything;
+            };
+        }
+
+        template <typename LeafHit>
+        bool traverse_subtree(uint32_t root, const ray& r, interval ray_t, LeafHit&& leaf_hit) const {
+            // Single ray traversal of the subtree below root; see traverse_leaves.
+            uint32_t stack[max_depth];
+            int stack_size = 0;
+            uint32_t node_index = root;
+            bool hit_anything = false;
+
+            while (true) {
+                const auto& node = nodes[node_index];
+                RT_COUNT(bvh_nodes_visited);
+
+                if (node.bbox.hit(r, ray_t)) {
+                    if (node.is_leaf()) {
+                        if (leaf_hit(node.offset, node.count, ray_t))
+                            hit_anything = true;
+                        if (stack_size == 0) break;
+                        node_index = stack[--stack_size];
+                    } else if (r.dir_is_neg(node.axis)) {
+                        // The second child holds the larger coordinates; visit it first.
+                        stack[stack_size++] = node_index + 1;
+                        node_index = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        node_index = node_index + 1;
+                    }
+                } else {
+                    if (stack_size == 0) break;
+                    node_index = stack[--stack_size];
+                }
+            }
+
+            return hit_anything;
+        }
+
+        bvh_build_options options;
+        bvh_build_report  report;
+
+        // Below this depth SAH splits are replaced by median splits, which always halve the span,
+        // so that the spans left at max_depth are small.
+        static const int sah_depth_limit = max_depth - 24;
+
+        struct split_choice {
+            int    axis = -1;    // -1 if no split plane separates the centroids
+            int    bin  = 0;     // Primitives in bins [0, bin] go to the first child
+            int    bin_count = 0;
+            double cost = infinity;
+        };
+
+        struct build_subtree {
+            // Nodes of a subtree, numbered from 0, plus its leaf statistics. Subtrees built by
+            // separate tasks are appended to their parent's nodes once they are finished.
+            std::vector<linear_bvh_node> nodes;
+            size_t leaves = 0;
+            int    depth  = 0;
+        };
+
+        struct build_primitive {
+            aabb     bounds;
+            point3   centroid;
+            uint32_t index;
+        };
+
+        std::vector<build_primitive> prims;  // Only used while building
+
+        struct bin {
+            aabb   bbox = aabb::empty;
+            size_t count = 0;
+        };
+
+        template <typename Fn>
+        static void parallel_chunks(int threads, uint32_t start, uint32_t end, Fn&& fn) {
+            /* Splits [start, end) into one chunk per thread and runs fn(chunk, begin, end) on each,
+               the first chunk on the calling thread. Small ranges are not worth a thread. */
+            const uint32_t min_chunk = 1024;
+            auto count = end - start;
+            auto chunks = int(std::max(1u, std::min(uint32_t(threads), count / min_chunk)));
+
+            std::vector<std::thread> workers;
+            for (int c = 1; c < chunks; c++) {
+                workers.emplace_back([&, c] {
+                    fn(c, start + uint32_t(uint64_t(count) * c / chunks),
+                          start + uint32_t(uint64_t(count) * (c+1) / chunks));
+                });
+            }
+            fn(0, start, start + uint32_t(count / chunks));
+
+            for (auto& w : workers)
+                w.join();
+        }
+
+        void build_recursive(build_subtree& tree, uint32_t start, uint32_t end, int depth, int threads) {
+            /* Appends the subtree over indices [start, end) to tree. threads is the number of
+               threads this subtree may use: large spans are reduced, binned and partitioned in
+               parallel, and their two children are built as concurrent tasks. */
+            auto node_index = uint32_t(tree.nodes.size());
+            tree.nodes.emplace_back();
+
+            auto count = end - start;
+            auto parallel = threads > 1 && count >= options.parallel_threshold;
+            auto span_threads = parallel ? threads : 1;
+
+            // Bounds of the primitives, and of their centroids to choose the split from.
+            aabb bbox, centroid_bounds;
+            span_bounds(start, end, span_threads, bbox, centroid_bounds);
+
+            tree.nodes[node_index].bbox = bbox;
+
+            // A node at depth d leaves at most d-1 entries on the traversal stack, so a span that
+            // reaches max_depth becomes a leaf however large it is. The median splits below
+            // sah_depth_limit keep such a leaf to a few hundred primitives at most.
+            if (count == 1 || depth >= max_depth) {
+                make_leaf(tree, node_index, start, count, depth);
+                return;
+            }
+
+            uint32_t mid = start;
+            int axis = centroid_bounds.longest_axis();
+
+            if (options.split == bvh_split_method::sah && depth < sah_depth_limit) {
+                auto split = find_sah_split(start, end, bbox, centroid_bounds, span_threads);
+                auto leaf_cost = options.intersection_cost * count;
+
+                if (count <= uint32_t(options.max_leaf_size) && leaf_cost <= split.cost) {
+                    make_leaf(tree, node_index, start, count, depth);
+                    return;
+                }
+
+                if (split.axis >= 0) {
+                    axis = split.axis;
+                    auto cmin = centroid_bounds.axis_interval(axis).min;
+                    auto scale = split.bin_count / centroid_bounds.axis_interval(axis).size();
+
+                    mid = partition(start, end, span_threads, [&](const build_primitive& p) {
+                        return bin_index(p.centroid[axis], cmin, scale, split.bin_count) <= split.bin;
+                    });
+                }
+            } else if (count <= uint32_t(options.max_leaf_size)) {
+                make_leaf(tree, node_index, start, count, depth);
+                return;
+            }
+
+            if (mid == start || mid == end) {
+                // Object median along the longest centroid axis. nth_element only partitions
+                // around the median instead of fully sorting the span. Also used when the SAH
+                // found no plane to split the centroids at (e.g. all centroids coincide).
+                mid = start + count/2;
+                std::nth_element(
+                    prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+                    [&](const build_primitive& a, const build_primitive& b) {
+                        return a.centroid[axis] < b.centroid[axis];
+                    }
+                );
+            }
+
+            uint32_t second;
+            if (parallel) {
+                // The children cover disjoint ranges of the primitives, so they can be built
+                // at the same time, each into its own node array.
+                build_subtree left, right;
+                auto left_threads = threads / 2;
+
+                std::thread left_task([&] {
+                    build_recursive(left, start, mid, depth + 1, left_threads);
+                });
+                build_recursive(right, mid, end, depth + 1, threads - left_threads);
+                left_task.join();
+
+                append(tree, left);
+                second = uint32_t(tree.nodes.size());
+                append(tree, right);
+            } else {
+                build_recursive(tree, start, mid, depth + 1, 1);
+                second = uint32_t(tree.nodes.size());
+                build_recursive(tree, mid, end, depth + 1, 1);
+            }
+
+            tree.nodes[node_index].offset = second;
+            tree.nodes[node_index].count  = 0;
+            tree.nodes[node_index].axis   = uint8_t(axis);
+        }
+
+        void span_bounds(uint32_t start, uint32_t end, int threads, aabb& bbox, aabb& centroid_bounds) const {
+            auto reduce = [&](uint32_t begin, uint32_t end, aabb& bbox, aabb& centroid_bounds) {
+                bbox = aabb::empty;
+                centroid_bounds = aabb::empty;
+                for (auto i = begin; i < end; i++) {
+                    bbox = aabb(bbox, prims[i].bounds);
+                    grow(centroid_bounds, prims[i].centroid);
+                }
+            };
+
+            if (threads <= 1) {
+                reduce(start, end, bbox, centroid_bounds);
+                return;
+            }
+
+            // Reduce each chunk on its own thread, then merge the partial boxes.
+            std::vector<aabb> chunk_bounds(threads), chunk_centroids(threads);
+            parallel_chunks(threads, start, end, [&](int c, uint32_t begin, uint32_t end) {
+                reduce(begin, end, chunk_bounds[c], chunk_centroids[c]);
+            });
+
+            bbox = aabb::empty;
+            centroid_bounds = aabb::empty;
+            for (int c = 0; c < threads; c++) {
+                bbox = aabb(bbox, chunk_bounds[c]);
+                centroid_bounds = aabb(centroid_bounds, chunk_centroids[c]);
+            }
+        }
+
+        static void append(build_subtree& tree, const build_subtree& child) {
+            // Child node numbers are relative to the child's root; shift them to their new place.
+            // Leaf offsets index the shared primitive index array and stay as they are.
+            auto base = uint32_t(tree.nodes.size());
+            for (auto node : child.nodes) {
+                if (!node.is_leaf())
+                    node.offset += base;
+                tree.nodes.push_back(node);
+            }
+
+            tree.leaves += child.leaves;
+            tree.depth = std::max(tree.depth, child.depth);
+        }
+
+        template <typename Predicate>
+        uint32_t partition(uint32_t start, uint32_t end, int threads, Predicate&& goes_left) {
+            // Moves the primitives for which goes_left is true to the front of [start, end) and
+            // returns the first position of the second group.
+            if (threads <= 1) {
+                auto it = std::partition(prims.begin() + start, prims.begin() + end, goes_left);
+                return uint32_t(it - prims.begin());
+            }
+
+            // Count each chunk's left side, then scatter every chunk to its place in a scratch
+            // buffer using the prefix sums of those counts.
+            std::vector<uint32_t> left_counts(threads, 0), chunk_begin(threads), chunk_end(threads);
+            parallel_chunks(threads, start, end, [&](int c, uint32_t begin, uint32_t end) {
+                chunk_begin[c] = begin;
+                chunk_end[c] = end;
+                for (auto i = begin; i < end; i++)
+                    left_counts[c] += goes_left(prims[i]);
+            });
+
+            uint32_t left_total = 0;
+            for (auto n : left_counts)
+                left_total += n;
+
+            std::vector<build_primitive> scratch(end - start);
+            std::vector<uint32_t> left_offset(threads), right_offset(threads);
+            uint32_t left_sum = 0, right_sum = left_total;
+            for (int c = 0; c < threads; c++) {
+                left_offset[c] = left_sum;
+                right_offset[c] = right_sum;
+                left_sum += left_counts[c];
+                right_sum += (chunk_end[c] - chunk_begin[c]) - left_counts[c];
+            }
+
+            parallel_chunks(threads, start, end, [&](int c, uint32_t begin, uint32_t end) {
+                auto l = left_offset[c], r = right_offset[c];
+                for (auto i = begin; i < end; i++) {
+                    if (goes_left(prims[i])) scratch[l++] = prims[i];
+                    else                     scratch[r++] = prims[i];
+                }
+            });
+
+            std::copy(scratch.begin(), scratch.end(), prims.begin() + start);
+            return start + left_total;
+        }
+
+        static int bin_index(double c, double cmin, double scale, int bin_count) {
+            auto b = int((c - cmin) * scale);
+            return b < bin_count ? b : bin_count - 1;
+        }
+
+        split_choice find_sah_split(
+            uint32_t start, uint32_t end, const aabb& bbox, const aabb& centroid_bounds, int threads
+        ) const {
+            // Bin the centroids along each axis and sweep the bin boundaries as split candidates.
+            // Cost of a split: C_trav + C_isect * (N_l * SA_l + N_r * SA_r) / SA_node
+            split_choice best;
+            // Small spans get two bins per primitive rather than the full count. Most nodes are
+            // small, and for them the extra empty bins would cost more than the binning itself.
+            auto bin_count = int(std::min(uint32_t(options.bin_count), std::max(2u, 2 * (end - start))));
+            best.bin_count = bin_count;
+            auto inv_area = 1.0 / bbox.surface_area();
+
+            // Every chunk fills its own set of bins for all three axes; they are merged after.
+            // The first set is reused across the nodes built on this thread, as small nodes are
+            // far more numerous than large ones and would otherwise be dominated by allocation.
+            thread_local std::vector<bin> bins;
+            thread_local std::vector<double> right_cost;
+            bins.assign(3 * bin_count, bin());
+            right_cost.resize(bin_count);
+
+            std::vector<std::vector<bin>> chunk_bins(threads - 1, std::vector<bin>(3 * bin_count));
+            double cmin[3], scale[3];
+            for (int axis = 0; axis < 3; axis++) {
+                const auto& extent = centroid_bounds.axis_interval(axis);
+                cmin[axis] = extent.min;
+                scale[axis] = extent.size() > 0 ? bin_count / extent.size() : 0;
+            }
+
+            parallel_chunks(threads, start, end, [&](int c, uint32_t begin, uint32_t end) {
+                auto& chunk = (c == 0) ? bins : chunk_bins[c-1];
+                for (auto i = begin; i < end; i++) {
+                    const auto& p = prims[i];
+                    for (int axis = 0; axis < 3; axis++) {
+                        auto& b = chunk[axis*bin_count + bin_index(p.centroid[axis], cmin[axis], scale[axis], bin_count)];
+                        b.bbox = aabb(b.bbox, p.bounds);
+                        b.count++;
+                    }
+                }
+            });
+
+            for (const auto& chunk : chunk_bins) {
+                for (int b = 0; b < 3 * bin_count; b++) {
+                    bins[b].bbox = aabb(bins[b].bbox, chunk[b].bbox);
+                    bins[b].count += chunk[b].count;
+                }
+            }
+
+            for (int axis = 0; axis < 3; axis++) {
+                if (centroid_bounds.axis_interval(axis).size() <= 0)
+                    continue;
+
+                const auto* axis_bins = &bins[axis * bin_count];
+
+                // Sweep from the right to get the cost of everything above each plane ...
+                aabb   right_box = aabb::empty;
+                size_t right_count = 0;
+                for (int b = bin_count - 1; b > 0; b--) {
+                    right_box = aabb(right_box, axis_bins[b].bbox);
+                    right_count += axis_bins[b].count;
+                    right_cost[b-1] = right_count ? right_count * right_box.surface_area() : 0;
+                }
+
+                // ... then from the left, combining both halves at each plane.
+                aabb   left_box = aabb::empty;
+                size_t left_count = 0;
+                for (int b = 0; b < bin_count - 1; b++) {
+                    left_box = aabb(left_box, axis_bins[b].bbox);
+                    left_count += axis_bins[b].count;
+
+                    if (left_count == 0 || left_count == end - start)
+                        continue;
+
+                    auto cost = options.traversal_cost + options.intersection_cost * inv_area
+                              * (left_count * left_box.surface_area() + right_cost[b]);
+
+                    if (cost < best.cost) {
+                        best.axis = axis;
+                        best.bin  = b;
+                        best.cost = cost;
+                    }
+                }
+            }
+
+            return best;
+        }
+
+        static void grow(aabb& box, const point3& p) {
+            // Extends box to contain p, without the minimum padding of the aabb constructors.
+            box.x = interval(std::fmin(box.x.min, p.x()), std::fmax(box.x.max, p.x()));
+            box.y = interval(std::fmin(box.y.min, p.y()), std::fmax(box.y.max, p.y()));
+            box.z = interval(std::fmin(box.z.min, p.z()), std::fmax(box.z.max, p.z()));
+        }
+
+        void make_leaf(build_subtree& tree, uint32_t node_index, uint32_t start, uint32_t count, int depth) {
+            tree.nodes[node_index].offset = start;
+            tree.nodes[node_index].count  = uint16_t(count);
+            tree.nodes[node_index].axis   = 0;
+
+            tree.leaves++;
+            tree.depth = std::max(tree.depth, depth);
+        }
+
+        double sah_cost() const {
+            // Expected cost of tracing a ray through the finished tree, relative to the root area.
+            if (nodes.empty())
+                return 0;
+
+            auto inv_root_area = 1.0 / nodes[0].bbox.surface_area();
+            double cost = 0;
+            for (const auto& node : nodes) {
+                auto area_ratio = node.bbox.surface_area() * inv_root_area;
+                cost += node.is_leaf() ? options.intersection_cost * node.count * area_ratio
+                                       : options.traversal_cost * area_ratio;
+            }
+            return cost;
+        }
+
+};
+
+class linear_bvh : public hittable {
+    /* Drop-in replacement for bvh_node. Primitives are stored once, as raw pointers in leaf order,
+       so traversal touches neither reference counts nor a virtual hit per tree level. The
+       shared_ptrs are kept only to own the primitives. */
+    public:
+        linear_bvh(const hittable_list& list, const bvh_build_options& options = {})
+            : objects(list.objects)
+        {
+            std::vector<aabb> bounds;
+            bounds.reserve(objects.size());
+            for (const auto& object : objects)
+                bounds.push_back(object->bounding_box());
+
+            tree.build(bounds, options);
+
+            primitives.reserve(objects.size());
+            for (auto index : tree.indices)
+                primitives.push_back(objects[index].get());
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return tree.traverse(r, ray_t, [&](uint32_t i, interval& t) {
+                if (!primitives[i]->hit(r, t, rec))
+                    return false;
+                t.max = rec.t;
+                return true;
+            });
+        }
+
+        uint32_t hit_packet(ray_packet& rays, uint32_t mask, packet_hits& hits) const override {
+            return tree.traverse_packet(rays, mask, [&](uint32_t i, uint32_t lanes) {
+                return primitives[i]->hit_packet(rays, lanes, hits);
+            });
+        }
+
+        aabb bounding_box() const override { return tree.bounding_box(); }
+
+        size_t node_count() const { return tree.nodes.size(); }
+
+        const bvh_build_report& build_report() const { return tree.build_report(); }
+
+        size_t memory_bytes() const {
+            // Bytes used by the hierarchy itself, not counting the primitives.
+            return tree.nodes.size() * sizeof(linear_bvh_node)
+                 + tree.indices.size() * sizeof(uint32_t)
+                 + primitives.size() * sizeof(const hittable*);
+        }
+
+    private:
+        bvh_tree tree;
+        std::vector<const hittable*> primitives;  // In leaf order, indexed by leaf ranges
+        std::vector<shared_ptr<hittable>> objects;
+};
+
+#endif
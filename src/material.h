@@ -2,50 +2,97 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "pdf.h"
 #include "texture.h"
 
+#include <cstdint>
+
+enum class material_kind : uint8_t { lambertian, metal, dielectric, diffuse_light, isotropic };
+const int material_kind_count = 5;
+static_assert(material_kind_count == stat_material_kind_count, "render_counters count scatters by kind");
+
 class material {
+    /* The set of materials is closed, like the set of textures: scatter() and emitted() switch
+       on the kind and call the final class directly, so shading a hit costs no virtual call.
+       A material that does not scatter or does not emit simply leaves out that function.
+
+       scatter() samples a direction and returns its weight (the BSDF times the cosine over the
+       density) as the attenuation. Materials that scatter over a spread of directions also
+       tell eval() and pdf() for any direction, so that a direction picked another way (towards
+       a light) can be weighted against the material's own choice. Mirror and glass directions
+       of metal and dielectric cannot be picked any other way, so they have no density. */
     public:
         virtual ~material() = default;
 
-        virtual bool scatter( const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const {
-            return false;
-        }
+        material_kind kind() const { return material_kind_; }
 
-        virtual color emitted(double u, double v, const point3& p) const {
-            return color(0,0,0);
+        // Number of the material in the order its scene made them, starting at 1 (see
+        // scene_arena::next_material_id())
+        uint32_t id() const { return id_; }
+
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const;
+
+        color emitted(double u, double v, const point3& p) const;
+
+        // True if eval() and pdf() are defined
+        bool has_pdf() const {
+            return material_kind_ == material_kind::lambertian || material_kind_ == material_kind::isotropic;
         }
+
+        // The BSDF (or phase function) times the cosine towards direction
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const;
+
+        // Density with which scatter() picks direction
+        double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const;
+
+        // Color of the surface at rec, as a guide for the denoiser
+        color albedo_at(const hit_record& rec) const;
+
+    protected:
+        material(material_kind kind) : material_kind_(kind), id_(scene_arena::next_material_id()) {}
+
+    private:
+        material_kind material_kind_;
+        uint32_t      id_;
 };
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
-        lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-        lambertian(shared_ptr<texture> tex) : tex(tex) {}
+        lambertian(const color& albedo)
+            : material(material_kind::lambertian), tex(make_scene_object<solid_color>(albedo)) {}
+        lambertian(shared_ptr<texture> tex) : material(material_kind::lambertian), tex(tex) {}
 
         bool scatter( const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
-            auto scatter_direction = rec.normal + random_unit_vector();
-
-            // Catch degenerate scatter direction (close to zero)
-            if (scatter_direction.near_zero())
-                scatter_direction = rec.normal;
-
-            scattered = ray(rec.p, scatter_direction, r_in.time());
+        ) const {
+            // Cosine weighted, so the BRDF (albedo / pi) times the cosine over the density is
+            // just the albedo.
+            scattered = ray(rec.p, cosine_pdf(rec.normal).generate(), r_in.time());
             attenuation = tex->value(rec.u, rec.v, rec.p);
             return true;
         }
-    
+
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            auto cosine = std::fmax(0, dot(unit_vector(direction), rec.normal));
+            return tex->value(rec.u, rec.v, rec.p) * (cosine / pi);
+        }
+
+        double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return cosine_pdf(rec.normal).value(direction);
+        }
+
+        color albedo_at(const hit_record& rec) const { return tex->value(rec.u, rec.v, rec.p); }
+
     private:
         shared_ptr<texture> tex;
 };
 
-class metal : public material {
+class metal final : public material {
     public:
-        metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+        metal(const color& albedo, double fuzz)
+            : material(material_kind::metal), albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
         
         bool scatter( const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
             vec3 reflected = reflect(r_in.direction(), rec.normal);
             reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
             scattered = ray(rec.p, reflected, r_in.time());
@@ -53,18 +100,21 @@ class metal : public material {
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
+        color albedo_at(const hit_record& rec) const { return albedo; }
+
 
     private:
         color albedo;
         double fuzz;
 };
 
-class dielectric : public material {
+class dielectric final : public material {
     public:
-        dielectric(double refraction_index) : refraction_index(refraction_index) {}
+        dielectric(double refraction_index)
+            : material(material_kind::dielectric), refraction_index(refraction_index) {}
 
         bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-        const override {
+        const {
             attenuation = color(1.0, 1.0, 1.0);
             double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -97,33 +147,111 @@ class dielectric : public material {
     }
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
     public:
-        diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
-        diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
+        diffuse_light(shared_ptr<texture> tex) : material(material_kind::diffuse_light), tex(tex) {}
+        diffuse_light(const color& emit)
+            : material(material_kind::diffuse_light), tex(make_scene_object<solid_color>(emit)) {}
 
-        color emitted(double u, double v, const point3& p) const override {
+        color emitted(double u, double v, const point3& p) const {
             return tex->value(u, v, p);
         }
 
+        color albedo_at(const hit_record& rec) const {
+            // The light's color, scaled down to at most 1
+            auto e = emitted(rec.u, rec.v, rec.p);
+            return e / std::fmax(1.0, std::fmax(e.x(), std::fmax(e.y(), e.z())));
+        }
+
     private:
         shared_ptr<texture> tex;
 };
 
-class isotropic : public material {
+class isotropic final : public material {
     public:
-        isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-        isotropic(shared_ptr<texture> tex) : tex(tex) {}
+        isotropic(const color& albedo)
+            : material(material_kind::isotropic), tex(make_scene_object<solid_color>(albedo)) {}
+        isotropic(shared_ptr<texture> tex) : material(material_kind::isotropic), tex(tex) {}
 
         bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) 
-        const override {
-            scattered = ray(rec.p, random_unit_vector(), r_in.time());
+        const {
+            // The phase function is uniform, 1 / (4 pi), and so is the sampling.
+            scattered = ray(rec.p, sphere_pdf().generate(), r_in.time());
             attenuation = tex->value(rec.u, rec.v, rec.p);
             return true;
         }
 
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return tex->value(rec.u, rec.v, rec.p) / (4 * pi);
+        }
+
+        double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return sphere_pdf().value(direction);
+        }
+
+        color albedo_at(const hit_record& rec) const { return tex->value(rec.u, rec.v, rec.p); }
+
     private:
         shared_ptr<texture> tex;
 };
 
+inline bool material::scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+    RT_COUNT(scatters[size_t(kind())]);
+    switch (kind()) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::metal:
+            return static_cast<const metal*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::dielectric:
+            return static_cast<const dielectric*>(this)->scatter(r_in, rec, attenuation, scattered);
+        case material_kind::isotropic:
+            return static_cast<const isotropic*>(this)->scatter(r_in, rec, attenuation, scattered);
+        default:
+            return false;
+    }
+}
+
+inline color material::eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+    switch (kind()) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian*>(this)->eval(r_in, rec, direction);
+        case material_kind::isotropic:
+            return static_cast<const isotropic*>(this)->eval(r_in, rec, direction);
+        default:
+            return color(0,0,0);
+    }
+}
+
+inline double material::pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+    switch (kind()) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian*>(this)->pdf(r_in, rec, direction);
+        case material_kind::isotropic:
+            return static_cast<const isotropic*>(this)->pdf(r_in, rec, direction);
+        default:
+            return 0;
+    }
+}
+
+inline color material::albedo_at(const hit_record& rec) const {
+    switch (kind()) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian*>(this)->albedo_at(rec);
+        case material_kind::metal:
+            return static_cast<const metal*>(this)->albedo_at(rec);
+        case material_kind::diffuse_light:
+            return static_cast<const diffuse_light*>(this)->albedo_at(rec);
+        case material_kind::isotropic:
+            return static_cast<const isotropic*>(this)->albedo_at(rec);
+        default:
+            return color(1,1,1);  // Glass passes everything
+    }
+}
+
+inline color material::emitted(double u, double v, const point3& p) const {
+    if (kind() == material_kind::diffuse_light)
+        return static_cast<const diffuse_light*>(this)->emitted(u, v, p);
+    return color(0,0,0);
+}
+
 #endif
\ No newline at end of file
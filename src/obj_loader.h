@@ -0,0 +1,250 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct obj_load_report {
+    size_t lines      = 0;
+    size_t bytes      = 0;  // Size of the file
+    size_t vertices   = 0;
+    size_t normals    = 0;
+    size_t uvs        = 0;
+    size_t triangles  = 0;  // After splitting polygons into triangles
+    double seconds    = 0;
+};
+
+class obj_loader {
+    /* Streaming reader for Wavefront OBJ geometry: v, vt, vn and f records (polygons are split
+       into triangle fans, negative indices count back from the end). Groups, objects, smoothing
+       and materials are ignored, so the whole file becomes one triangle_mesh.
+
+       The file is read in large blocks and parsed in place with std::from_chars, so no string is
+       made per line and memory grows only with the mesh itself. */
+    public:
+        static bool load(const std::string& filename, triangle_mesh& mesh, obj_load_report* report = nullptr) {
+            // Appends the file's geometry to mesh. On failure prints the reason and returns false.
+            auto start_time = std::chrono::steady_clock::now();
+
+            auto file = std::fopen(filename.c_str(), "rb");
+            if (!file) {
+                std::cerr << "ERROR: Could not open OBJ file '" << filename << "'.\n";
+                return false;
+            }
+
+            obj_loader loader(mesh);
+            std::vector<char> buffer(block_size);
+            size_t filled = 0;   // Bytes in buffer, the start of which is an unfinished line
+            bool ok = true;
+
+            while (ok) {
+                if (filled == buffer.size())  // A single line longer than the buffer
+                    buffer.resize(2 * buffer.size());
+
+                auto read = std::fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+                loader.stats.bytes += read;
+                filled += read;
+                auto at_end = read == 0;
+
+                // Parse every complete line; at the end of the file the last line needs no '\n'.
+                auto data = buffer.data();
+                auto end = data + filled;
+                if (!at_end) {
+                    while (end > data && end[-1] != '\n')
+                        end--;
+                }
+
+                auto line = data;
+                while (line < end && ok) {
+                    auto line_end = static_cast<char*>(std::memchr(line, '\n', size_t(end - line)));
+                    if (!line_end)
+                        line_end = end;
+                    ok = loader.parse_line(line, line_end);
+                    line = line_end + 1;
+                }
+
+                if (at_end || !ok)
+                    break;
+
+                filled = size_t(data + filled - end);
+                std::memmove(data, end, filled);
+            }
+
+            std::fclose(file);
+
+            if (!ok) {
+                std::cerr << "ERROR: Could not parse line " << loader.stats.lines << " of OBJ file '"
+                          << filename << "'.\n";
+                return false;
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+            loader.stats.seconds = elapsed.count();
+            if (report)
+                *report = loader.stats;
+            return true;
+        }
+
+    private:
+        static const size_t block_size = 1 << 20;
+
+        triangle_mesh& mesh;
+        obj_load_report stats;
+
+        // Sizes of the mesh's lists before the file, which its indices count from
+        size_t position_base, uv_base, normal_base;
+
+        obj_loader(triangle_mesh& mesh)
+            : mesh(mesh), position_base(mesh.positions.size()), uv_base(mesh.uvs.size()),
+              normal_base(mesh.normals.size()) {}
+
+        bool parse_line(const char* p, const char* end) {
+            stats.lines++;
+            p = skip_spaces(p, end);
+            if (p == end || *p == '#' || *p == '\r')
+                return true;
+
+            auto keyword = p;
+            while (p < end && !is_space(*p))
+                p++;
+            auto length = p - keyword;
+
+            if (length == 1 && keyword[0] == 'v') {
+                double x, y, z;
+                if (!parse_double(p, end, x) || !parse_double(p, end, y) || !parse_double(p, end, z))
+                    return false;
+                mesh.positions.emplace_back(x, y, z);  // A fourth (w) coordinate is ignored
+                stats.vertices++;
+            } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+                double x, y, z;
+                if (!parse_double(p, end, x) || !parse_double(p, end, y) || !parse_double(p, end, z))
+                    return false;
+                mesh.normals.emplace_back(x, y, z);
+                stats.normals++;
+            } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+                double u, v = 0;
+                if (!parse_double(p, end, u))
+                    return false;
+                parse_double(p, end, v);  // v is optional
+                mesh.uvs.push_back({u, v});
+                stats.uvs++;
+            } else if (length == 1 && keyword[0] == 'f') {
+                return parse_face(p, end);
+            }
+            // Anything else (o, g, s, usemtl, mtllib, l, ...) is skipped.
+            return true;
+        }
+
+        struct corner {
+            uint32_t position;
+            int64_t  uv     = -1;
+            int64_t  normal = -1;
+        };
+
+        bool parse_face(const char* p, const char* end) {
+            // Polygons become fans around their first corner: (0, 1, 2), (0, 2, 3), ...
+            corner first{}, previous{}, current{};
+            int corners = 0;
+
+            while (true) {
+                p = skip_spaces(p, end);
+                if (p == end || *p == '\r' || *p == '#')
+                    break;
+                if (!parse_corner(p, end, current))
+                    return false;
+
+                if (corners == 0)
+                    first = current;
+                else if (corners >= 2)
+                    add_triangle(first, previous, current);
+
+                previous = current;
+                corners++;
+            }
+
+            return corners >= 3;
+        }
+
+        bool parse_corner(const char*& p, const char* end, corner& c) {
+            // v, v/vt, v//vn or v/vt/vn
+            int64_t index;
+            if (!parse_index(p, end, position_base, mesh.positions.size(), index))
+                return false;
+            c.position = uint32_t(index);
+            c.uv = c.normal = -1;
+
+            if (p < end && *p == '/') {
+                p++;
+                if (p < end && *p != '/') {
+                    if (!parse_index(p, end, uv_base, mesh.uvs.size(), c.uv))
+                        return false;
+                }
+                if (p < end && *p == '/') {
+                    p++;
+                    if (!parse_index(p, end, normal_base, mesh.normals.size(), c.normal))
+                        return false;
+                }
+            }
+
+            return p == end || is_space(*p);
+        }
+
+        void add_triangle(const corner& a, const corner& b, const corner& c) {
+            // A face without texture coordinates or normals leaves those index arrays short, and
+            // triangle_mesh::build then drops them for the whole mesh.
+            mesh.add_triangle(a.position, b.position, c.position);
+            if (a.uv >= 0 && b.uv >= 0 && c.uv >= 0)
+                mesh.uv_indices.insert(mesh.uv_indices.end(), {uint32_t(a.uv), uint32_t(b.uv), uint32_t(c.uv)});
+            if (a.normal >= 0 && b.normal >= 0 && c.normal >= 0)
+                mesh.normal_indices.insert(
+                    mesh.normal_indices.end(), {uint32_t(a.normal), uint32_t(b.normal), uint32_t(c.normal)}
+                );
+            stats.triangles++;
+        }
+
+        static bool parse_index(const char*& p, const char* end, size_t base, size_t count, int64_t& index) {
+            // OBJ indices start at 1 with the file's first element, which sits at base in the
+            // mesh; negative ones are relative to the end of the list so far. Either way they
+            // have to point into the file's own elements.
+            int64_t value;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc() || value == 0)
+                return false;
+            p = result.ptr;
+
+            index = value > 0 ? int64_t(base) + value - 1 : int64_t(count) + value;
+            return index >= int64_t(base) && index < int64_t(count);
+        }
+
+        static bool parse_double(const char*& p, const char* end, double& value) {
+            p = skip_spaces(p, end);
+            if (p < end && *p == '+')  // from_chars does not take a leading plus sign
+                p++;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc())
+                return false;
+            p = result.ptr;
+            return true;
+        }
+
+        static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+        static const char* skip_spaces(const char* p, const char* end) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            return p;
+        }
+};
+
+inline bool load_obj(const std::string& filename, triangle_mesh& mesh, obj_load_report* report = nullptr) {
+    return obj_loader::load(filename, mesh, report);
+}
+
+#endif
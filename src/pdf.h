@@ -0,0 +1,51 @@
+#ifndef PDF_H
+#define PDF_H
+
+#include "hittable.h"
+
+class cosine_pdf {
+    /* Directions about the unit vector w with density cos(theta) / pi, as a diffuse surface
+       scatters. w plus a uniform random unit vector has exactly that distribution, and is
+       cheaper than building a basis around w to map a cosine weighted direction into. */
+    public:
+        cosine_pdf(const vec3& w) : w(w) {}
+
+        double value(const vec3& direction) const {
+            auto cosine_theta = dot(unit_vector(direction), w);
+            return std::fmax(0, cosine_theta / pi);
+        }
+
+        vec3 generate() const {
+            auto direction = w + random_unit_vector();
+
+            // Catch degenerate scatter direction (close to zero)
+            return direction.near_zero() ? w : direction;
+        }
+
+    private:
+        vec3 w;
+};
+
+class sphere_pdf {
+    // Directions uniform over the whole sphere, as an isotropic medium scatters.
+    public:
+        double value(const vec3& direction) const { return 1 / (4 * pi); }
+
+        vec3 generate() const { return random_unit_vector(); }
+};
+
+class hittable_pdf {
+    // Directions from origin towards random points of objects (usually the lights).
+    public:
+        hittable_pdf(const hittable& objects, const point3& origin) : objects(objects), origin(origin) {}
+
+        double value(const vec3& direction) const { return objects.pdf_value(origin, direction); }
+
+        vec3 generate() const { return objects.random(origin); }
+
+    private:
+        const hittable& objects;
+        point3 origin;
+};
+
+#endif
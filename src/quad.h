@@ -13,6 +13,7 @@ class quad : public hittable {
             normal  = unit_vector(n);
             D = dot(normal, Q);
             w = n / dot(n,n);
+            area = n.length();
 
             set_bounding_box();
         }
@@ -27,6 +28,7 @@ class quad : public hittable {
         aabb bounding_box() const override { return bbox; }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_COUNT(quad_tests);
             auto denom = dot(normal, r.direction());
 
             // No hit if the ray is parallel to the plane.
@@ -50,12 +52,73 @@ class quad : public hittable {
             // Ray hits the 2D shape; set the rest of the hit record and return true; 
             rec.t = t;
             rec.p = intersection;
-            rec.mat = mat;
+            rec.mat = mat.get();
             rec.set_face_normal(r, normal);
 
             return true;
         }
 
+        uint32_t hit_packet(ray_packet& rays, uint32_t mask, packet_hits& hits) const override {
+            if (lane_count(mask) < 2)
+                return hittable::hit_packet(rays, mask, hits);
+
+            /* Plane distance and plane coordinates of all lanes first, in a loop that vectorizes;
+               the interior test and hit record only run for lanes that hit the plane. */
+            RT_COUNT_N(quad_tests, lane_count(mask));
+            double ts[ray_packet::max_size], alphas[ray_packet::max_size], betas[ray_packet::max_size];
+            auto vw = cross(v, w), wu = cross(w, u);  // dot(w, cross(p, v)) == dot(p, cross(v, w))
+
+            for (int lane = 0; lane < rays.size; lane++) {
+                auto denom = normal.x()*rays.dx[lane] + normal.y()*rays.dy[lane] + normal.z()*rays.dz[lane];
+                auto t = (D - (normal.x()*rays.ox[lane] + normal.y()*rays.oy[lane] + normal.z()*rays.oz[lane])) / denom;
+
+                auto px = rays.ox[lane] + t*rays.dx[lane] - Q.x();
+                auto py = rays.oy[lane] + t*rays.dy[lane] - Q.y();
+                auto pz = rays.oz[lane] + t*rays.dz[lane] - Q.z();
+                alphas[lane] = px*vw.x() + py*vw.y() + pz*vw.z();
+                betas[lane]  = px*wu.x() + py*wu.y() + pz*wu.z();
+
+                auto in_range = std::fabs(denom) >= 1e-8 && rays.t_min[lane] <= t && t <= rays.t_max[lane];
+                ts[lane] = in_range ? t : -infinity;
+            }
+
+            uint32_t hit_mask = 0;
+            for (int lane = 0; lane < rays.size; lane++) {
+                if (!(mask & (1u << lane)) || ts[lane] == -infinity)
+                    continue;
+
+                auto& rec = hits.rec[lane];
+                if (!is_interior(alphas[lane], betas[lane], rec))
+                    continue;
+
+                auto r = rays.get(lane);
+                rec.t = ts[lane];
+                rec.p = r.at(ts[lane]);
+                rec.mat = mat.get();
+                rec.set_face_normal(r, normal);
+
+                rays.t_max[lane] = ts[lane];
+                hit_mask |= 1u << lane;
+            }
+            return hit_mask;
+        }
+
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // Uniform over the area, converted to solid angle: distance^2 / (cosine * area).
+            hit_record rec;
+            if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+                return 0;
+
+            auto distance_squared = rec.t * rec.t * direction.length_squared();
+            auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+            return distance_squared / (cosine * area);
+        }
+
+        vec3 random(const point3& origin) const override {
+            auto p = Q + (random_double() * u) + (random_double() * v);
+            return p - origin;
+        }
+
         virtual bool is_interior(double a, double b, hit_record& rec) const {
             interval unit_interval = interval(0, 1);
             // Given the hit point in plane coordinates, return false if it is outside the
@@ -77,11 +140,12 @@ class quad : public hittable {
         aabb bbox;
         vec3 normal;
         double D;
+        double area;
 };
 
 inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat) {
     // Return the 3D box (six sides) that contains the two opposite vertices a & b.
-    auto sides = make_shared<hittable_list>();
+    auto sides = make_scene_object<hittable_list>();
 
     //Construct the two opposite vertices with minimum and maximum coordinates.
     auto min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
@@ -91,12 +155,12 @@ inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_pt
     auto dy = vec3(0, max.y()- min.y(), 0);
     auto dz = vec3(0, 0, max.z()- min.z());
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat));  // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat));  // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat));  // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat));  // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat));  // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat));  // bottom
+    sides->add(make_scene_object<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat));  // front
+    sides->add(make_scene_object<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat));  // right
+    sides->add(make_scene_object<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat));  // back
+    sides->add(make_scene_object<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat));  // left
+    sides->add(make_scene_object<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat));  // top
+    sides->add(make_scene_object<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat));  // bottom
 
     return sides;
 }
@@ -8,7 +8,13 @@ class ray {
         ray() {}
 
         ray(const point3& origin, const point3& direction, double time) 
-           : orig(origin), dir(direction), tm(time) {}
+           : orig(origin), dir(direction), tm(time)
+        {
+            // Cached for box tests, which would otherwise divide three times per box.
+            inv_dir = vec3(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+            for (int axis = 0; axis < 3; axis++)
+                sign[axis] = inv_dir[axis] < 0;
+        }
 
         ray(const point3& origin, const point3& direction) 
            : ray(origin, direction, 0) {}
@@ -17,6 +23,11 @@ class ray {
         const point3& origin()    const { return orig; }
         const vec3&   direction() const { return dir; }
 
+        const vec3& inv_direction() const { return inv_dir; }  // Component-wise 1 / direction
+
+        // 1 if the ray travels towards smaller coordinates along axis, 0 otherwise.
+        int dir_is_neg(int axis) const { return sign[axis]; }
+
         double time() const { return tm; }
 
         point3 at(double t) const {
@@ -27,6 +38,8 @@ class ray {
         point3 orig;
         vec3 dir;
         double tm;
+        vec3 inv_dir;
+        int sign[3] = {0, 0, 0};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "aabb.h"
+
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+inline int lane_count(uint32_t mask) {
+    int count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+inline int first_lane(uint32_t mask) {
+    // Index of the lowest set bit; mask must not be zero.
+    int lane = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        lane++;
+    }
+    return lane;
+}
+
+struct alignas(64) ray_packet {
+    /* Up to max_size rays traced together, stored as structure of arrays so that one box or
+       primitive test covers several rays per SIMD instruction. Lanes are addressed by bit masks;
+       t_max of a lane shrinks as closer hits are found, exactly like ray_t.max of a single ray. */
+    static const int max_size = 16;
+
+    double ox[max_size]     = {}, oy[max_size]     = {}, oz[max_size]     = {};
+    double dx[max_size]     = {}, dy[max_size]     = {}, dz[max_size]     = {};
+    double inv_dx[max_size] = {}, inv_dy[max_size] = {}, inv_dz[max_size] = {};
+    double time[max_size]   = {};
+    double t_min[max_size]  = {}, t_max[max_size]  = {};
+    int    size = 0;  // Number of lanes in use
+
+    void set(int lane, const ray& r, const interval& ray_t) {
+        ox[lane] = r.origin().x();
+        oy[lane] = r.origin().y();
+        oz[lane] = r.origin().z();
+        dx[lane] = r.direction().x();
+        dy[lane] = r.direction().y();
+        dz[lane] = r.direction().z();
+        inv_dx[lane] = r.inv_direction().x();
+        inv_dy[lane] = r.inv_direction().y();
+        inv_dz[lane] = r.inv_direction().z();
+        time[lane] = r.time();
+        t_min[lane] = ray_t.min;
+        t_max[lane] = ray_t.max;
+    }
+
+    ray get(int lane) const {
+        return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]), time[lane]);
+    }
+
+    interval range(int lane) const { return interval(t_min[lane], t_max[lane]); }
+
+    uint32_t all() const { return size >= 32 ? ~0u : (1u << size) - 1; }
+};
+
+inline uint32_t packet_box_hit(const aabb& box, const ray_packet& rays, uint32_t mask) {
+    /* Slab test of every lane in mask against the box. Returns the lanes whose [t_min, t_max]
+       overlaps the box, with the same open bounds as aabb::hit. Lanes are processed four at a
+       time with AVX, two at a time with SSE2, and one at a time otherwise. */
+    uint32_t result = 0;
+
+#if defined(__AVX__)
+    for (int g = 0; g < rays.size; g += 4) {
+        if (!((mask >> g) & 0xf))
+            continue;
+
+        auto tmin = _mm256_loadu_pd(rays.t_min + g);
+        auto tmax = _mm256_loadu_pd(rays.t_max + g);
+
+        auto slab = [&](const interval& ax, const double* o, const double* inv) {
+            auto origin = _mm256_loadu_pd(o + g);
+            auto inverse = _mm256_loadu_pd(inv + g);
+            auto t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(ax.min), origin), inverse);
+            auto t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(ax.max), origin), inverse);
+            tmin = _mm256_max_pd(tmin, _mm256_min_pd(t0, t1));
+            tmax = _mm256_min_pd(tmax, _mm256_max_pd(t0, t1));
+        };
+        slab(box.x, rays.ox, rays.inv_dx);
+        slab(box.y, rays.oy, rays.inv_dy);
+        slab(box.z, rays.oz, rays.inv_dz);
+
+        result |= uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(tmin, tmax, _CMP_LT_OQ))) << g;
+    }
+#elif defined(__SSE2__)
+    for (int g = 0; g < rays.size; g += 2) {
+        if (!((mask >> g) & 0x3))
+            continue;
+
+        auto tmin = _mm_loadu_pd(rays.t_min + g);
+        auto tmax = _mm_loadu_pd(rays.t_max + g);
+
+        auto slab = [&](const interval& ax, const double* o, const double* inv) {
+            auto origin = _mm_loadu_pd(o + g);
+            auto inverse = _mm_loadu_pd(inv + g);
+            auto t0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(ax.min), origin), inverse);
+            auto t1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(ax.max), origin), inverse);
+            tmin = _mm_max_pd(tmin, _mm_min_pd(t0, t1));
+            tmax = _mm_min_pd(tmax, _mm_max_pd(t0, t1));
+        };
+        slab(box.x, rays.ox, rays.inv_dx);
+        slab(box.y, rays.oy, rays.inv_dy);
+        slab(box.z, rays.oz, rays.inv_dz);
+
+        result |= uint32_t(_mm_movemask_pd(_mm_cmplt_pd(tmin, tmax))) << g;
+    }
+#else
+    for (int lane = 0; lane < rays.size; lane++) {
+        if (!(mask & (1u << lane)))
+            continue;
+
+        auto tmin = rays.t_min[lane], tmax = rays.t_max[lane];
+        auto slab = [&](const interval& ax, double o, double inv) {
+            auto t0 = (ax.min - o) * inv;
+            auto t1 = (ax.max - o) * inv;
+            tmin = std::fmax(tmin, std::fmin(t0, t1));
+            tmax = std::fmin(tmax, std::fmax(t0, t1));
+        };
+        slab(box.x, rays.ox[lane], rays.inv_dx[lane]);
+        slab(box.y, rays.oy[lane], rays.inv_dy[lane]);
+        slab(box.z, rays.oz[lane], rays.inv_dz[lane]);
+
+        if (tmin < tmax)
+            result |= 1u << lane;
+    }
+#endif
+
+    return result & mask;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+// How a path ended
+enum class path_end { missed, absorbed, light, roulette, max_depth };
+const int path_end_count = 5;
+
+// Same as material_kind_count, which material.h checks; the counters sit below material.h.
+const int stat_material_kind_count = 5;
+
+struct render_counters {
+    /* Counts of what the hot paths do, to tell whether a slow render comes from the BVH, from
+       long paths or from the volumes. Each thread counts into its own (thread_counters()), so
+       counting never contends, and the camera adds up its workers' counters at the end of a
+       render. Compiled in with RT_STATS; without it RT_COUNT expands to nothing and every
+       count stays 0. */
+    static const int depth_slots = 16;  // Rays of deeper bounces count in the last slot
+
+    std::array<uint64_t, depth_slots> rays_by_depth{};  // Depth 0 are the camera rays
+    uint64_t shadow_rays       = 0;
+    uint64_t bvh_nodes_visited = 0;
+    uint64_t aabb_hits         = 0;  // aabb::hit calls
+    uint64_t sphere_tests      = 0;  // Ray-primitive tests, one per ray (or packet lane)
+    uint64_t quad_tests        = 0;
+    uint64_t triangle_tests    = 0;
+    uint64_t medium_tests      = 0;  // constant_medium::hit, not counting its boundary's tests
+    std::array<uint64_t, stat_material_kind_count> scatters{};  // By material_kind
+    std::array<uint64_t, path_end_count> path_ends{};           // By path_end
+    uint64_t bvh_builds        = 0;
+    double   bvh_build_seconds = 0;
+
+    static int depth_slot(int depth) { return std::min(depth, depth_slots - 1); }
+
+    uint64_t rays() const {
+        uint64_t total = shadow_rays;
+        for (auto n : rays_by_depth)
+            total += n;
+        return total;
+    }
+
+    void add(const render_counters& other) {
+        for (int d = 0; d < depth_slots; d++)
+            rays_by_depth[d] += other.rays_by_depth[d];
+        shadow_rays       += other.shadow_rays;
+        bvh_nodes_visited += other.bvh_nodes_visited;
+        aabb_hits         += other.aabb_hits;
+        sphere_tests      += other.sphere_tests;
+        quad_tests        += other.quad_tests;
+        triangle_tests    += other.triangle_tests;
+        medium_tests      += other.medium_tests;
+        for (int k = 0; k < stat_material_kind_count; k++)
+            scatters[k] += other.scatters[k];
+        for (int e = 0; e < path_end_count; e++)
+            path_ends[e] += other.path_ends[e];
+        bvh_builds        += other.bvh_builds;
+        bvh_build_seconds += other.bvh_build_seconds;
+    }
+
+    void print(std::ostream& out) const {
+        // As a table of counts, with the share of their group or the count per ray.
+        auto total = rays();
+        auto per_ray = [&](uint64_t n) { return total ? double(n) / total : 0.0; };
+        auto row = [&](const char* group, const std::string& name, uint64_t n, double ratio,
+                       const char* unit) {
+            out << "  " << std::left << std::setw(12) << group << std::setw(18) << name << std::right
+                << std::setw(16) << n << std::setw(12) << std::setprecision(4) << ratio << ' ' << unit
+                << '\n';
+        };
+
+        for (int d = 0; d < depth_slots; d++) {
+            if (rays_by_depth[d] == 0)
+                continue;
+            auto name = "depth " + std::to_string(d) + (d == depth_slots - 1 ? "+" : "");
+            row("rays", name, rays_by_depth[d], per_ray(rays_by_depth[d]), "of rays");
+        }
+        row("rays", "shadow", shadow_rays, per_ray(shadow_rays), "of rays");
+
+        row("traversal", "bvh nodes", bvh_nodes_visited, per_ray(bvh_nodes_visited), "per ray");
+        row("traversal", "aabb::hit", aabb_hits, per_ray(aabb_hits), "per ray");
+
+        row("primitives", "sphere", sphere_tests, per_ray(sphere_tests), "per ray");
+        row("primitives", "quad", quad_tests, per_ray(quad_tests), "per ray");
+        row("primitives", "triangle", triangle_tests, per_ray(triangle_tests), "per ray");
+        row("primitives", "constant_medium", medium_tests, per_ray(medium_tests), "per ray");
+
+        uint64_t scatter_total = 0, end_total = 0;
+        for (auto n : scatters)  scatter_total += n;
+        for (auto n : path_ends) end_total += n;
+        for (int k = 0; k < stat_material_kind_count; k++) {
+            row("scatter", material_kind_names()[k], scatters[k],
+                scatter_total ? double(scatters[k]) / scatter_total : 0.0, "of scatters");
+        }
+        for (int e = 0; e < path_end_count; e++) {
+            row("path ends", path_end_names()[e], path_ends[e],
+                end_total ? double(path_ends[e]) / end_total : 0.0, "of paths");
+        }
+
+        if (bvh_builds)
+            out << "  " << bvh_builds << " BVH builds in " << 1000 * bvh_build_seconds << " ms\n";
+    }
+
+    void write_json(std::ostream& out) const {
+        auto list = [&](const char* key, const auto& values, const char* const* names) {
+            out << "  \"" << key << "\": {";
+            for (size_t i = 0; i < values.size(); i++)
+                out << (i ? ", " : "") << '"' << names[i] << "\": " << values[i];
+            out << "},\n";
+        };
+
+        out << "{\n  \"rays_by_depth\": [";
+        for (int d = 0; d < depth_slots; d++)
+            out << (d ? ", " : "") << rays_by_depth[d];
+        out << "],\n";
+        out << "  \"shadow_rays\": " << shadow_rays << ",\n";
+        out << "  \"bvh_nodes_visited\": " << bvh_nodes_visited << ",\n";
+        out << "  \"aabb_hits\": " << aabb_hits << ",\n";
+        out << "  \"primitive_tests\": {\"sphere\": " << sphere_tests << ", \"quad\": " << quad_tests
+            << ", \"triangle\": " << triangle_tests << ", \"constant_medium\": " << medium_tests << "},\n";
+        list("scatters", scatters, material_kind_names());
+        list("path_ends", path_ends, path_end_names());
+        out << "  \"bvh_builds\": " << bvh_builds << ",\n";
+        out << "  \"bvh_build_seconds\": " << bvh_build_seconds << "\n}\n";
+    }
+
+    static const char* const* material_kind_names() {
+        static const char* names[stat_material_kind_count] = {
+            "lambertian", "metal", "dielectric", "diffuse_light", "isotropic"
+        };
+        return names;
+    }
+
+    static const char* const* path_end_names() {
+        static const char* names[path_end_count] = {"missed", "absorbed", "light", "roulette", "max_depth"};
+        return names;
+    }
+};
+
+inline render_counters& thread_counters() {
+    thread_local render_counters counters;
+    return counters;
+}
+
+#ifdef RT_STATS
+const bool render_stats_enabled = true;
+#define RT_COUNT(counter)      (thread_counters().counter++)
+#define RT_COUNT_N(counter, n) (thread_counters().counter += (n))
+#else
+const bool render_stats_enabled = false;
+#define RT_COUNT(counter)      ((void)0)
+#define RT_COUNT_N(counter, n) ((void)0)
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #define RTUTILS_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -20,9 +21,72 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+class xoshiro256plus {
+    /* xoshiro256+ generator (Blackman & Vigna). Small, fast and good enough for sampling; the
+       low bits are weak, so doubles and bounded integers are built from the high bits only. */
+    public:
+        xoshiro256plus(uint64_t seed = 0x853c49e6748fea9bULL) { reseed(seed); }
+
+        void reseed(uint64_t seed) {
+            // Expand the seed into the 256-bit state with splitmix64, as recommended by the authors.
+            for (auto& word : s)
+                word = splitmix64(seed);
+        }
+
+        uint64_t next() {
+            const uint64_t result = s[0] + s[3];
+            const uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+        double next_double() {
+            // Returns a random real in [0,1) using the top 53 bits.
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        static uint64_t splitmix64(uint64_t& state) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+    private:
+        uint64_t s[4];
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+};
+
+inline xoshiro256plus& thread_rng() {
+    // Each thread owns its generator, so sampling never contends on shared state.
+    thread_local xoshiro256plus generator;
+    return generator;
+}
+
+inline void seed_random(uint64_t seed) {
+    // Reseeds the calling thread's generator only.
+    thread_rng().reseed(seed);
+}
+
+inline uint64_t hash_seed(uint64_t seed, uint64_t a, uint64_t b = 0) {
+    // Derive an independent stream seed from a base seed and two indices.
+    uint64_t state = seed ^ (a * 0xd1b54a32d192ed03ULL) ^ (b * 0xaef17502108ef2d9ULL);
+    return xoshiro256plus::splitmix64(state);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -32,13 +96,17 @@ inline double random_double(double min, double max) {
 
 inline int random_int(int min, int max) {
     // Returns a random integer in [min,max]
-    return int(random_double(min, max+1));
+    // Multiply-shift of the top 32 bits maps onto the range without a division.
+    auto range = uint64_t(int64_t(max) - min + 1);
+    return int(min + int64_t(((thread_rng().next() >> 32) * range) >> 32));
 }
 
 // Common Headers
 #include "color.h"
 #include "interval.h"
 #include "ray.h"
+#include "render_stats.h"
+#include "scene_arena.h"
 #include "vec3.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class scene_arena {
+    /* Owns every object of one scene: hittables, materials and textures. Each type gets its own
+       pool of large blocks that objects are bumped into, so objects of one type sit next to each
+       other in creation order, and the whole scene goes away in one release() instead of one
+       free per object.
+
+       make() hands out shared_ptrs that do not own their object (built with the aliasing
+       constructor around an empty owner), so the rest of the code keeps its shared_ptr
+       interfaces while copies of these pointers never touch a reference count. The arena must
+       therefore outlive every object it made and everything pointing at them; scene keeps it
+       alongside its world.
+
+       While a scope is active on a thread, make_scene_object() allocates from that arena, which
+       also catches the objects made inside constructors (the solid_color of a lambertian, the
+       quads of a box). A scope also numbers the materials made in it from 1, so a scene's
+       material ids do not depend on what was built before it. */
+    public:
+        scene_arena() {}
+        scene_arena(const scene_arena&) = delete;
+        scene_arena& operator=(const scene_arena&) = delete;
+
+        ~scene_arena() { release(); }
+
+        template <typename T, typename... Args>
+        shared_ptr<T> make(Args&&... args) {
+            auto& p = pools[std::type_index(typeid(T))];
+            if (p.blocks.empty() || p.used == p.block_objects) {
+                // Blocks start small, for the many types a scene has only a few objects of, and
+                // double up to max_block_bytes.
+                p.block_objects = std::max<size_t>(
+                    1, std::min(std::max(first_block_bytes / sizeof(T), 2 * p.block_objects),
+                                max_block_bytes / sizeof(T))
+                );
+                p.blocks.push_back(static_cast<std::byte*>(
+                    ::operator new(p.block_objects * sizeof(T), std::align_val_t(alignof(T)))
+                ));
+                p.used = 0;
+                p.alignment = alignof(T);
+                reserved += p.block_objects * sizeof(T);
+            }
+
+            auto object = new (p.blocks.back() + p.used * sizeof(T)) T(std::forward<Args>(args)...);
+            p.used++;
+            objects++;
+
+            if constexpr (!std::is_trivially_destructible_v<T>)
+                destructors.push_back({object, [](void* o) { static_cast<T*>(o)->~T(); }});
+
+            return shared_ptr<T>(shared_ptr<void>(), object);
+        }
+
+        void release() {
+            // Destroys the objects, newest first, then frees the blocks.
+            for (auto d = destructors.rbegin(); d != destructors.rend(); ++d)
+                d->destroy(d->object);
+            destructors.clear();
+
+            for (auto& [type, p] : pools) {
+                for (auto block : p.blocks)
+                    ::operator delete(block, std::align_val_t(p.alignment));
+            }
+            pools.clear();
+            objects = 0;
+            reserved = 0;
+        }
+
+        size_t object_count()   const { return objects; }
+        size_t type_count()     const { return pools.size(); }
+        size_t bytes_reserved() const { return reserved; }
+
+        class scope {
+            // Makes an arena the one make_scene_object() allocates from on this thread, until the
+            // scope ends. A null arena means the heap.
+            public:
+                scope(scene_arena* arena) : previous(current()), previous_ids(material_ids()) {
+                    current() = arena;
+                    material_ids() = 0;
+                }
+                ~scope() {
+                    current() = previous;
+                    material_ids() = previous_ids;
+                }
+
+                scope(const scope&) = delete;
+                scope& operator=(const scope&) = delete;
+
+            private:
+                scene_arena* previous;
+                uint32_t     previous_ids;
+        };
+
+        static scene_arena*& current() {
+            thread_local scene_arena* arena = nullptr;
+            return arena;
+        }
+
+        // Id for a new material: one more than the last made in the current scope on this thread
+        static uint32_t next_material_id() { return ++material_ids(); }
+
+    private:
+        static uint32_t& material_ids() {
+            thread_local uint32_t made = 0;
+            return made;
+        }
+
+        static const size_t first_block_bytes = 1024;
+        static const size_t max_block_bytes   = 64 * 1024;
+
+        struct pool {
+            std::vector<std::byte*> blocks;
+            size_t alignment     = 0;
+            size_t block_objects = 0;  // Objects in the last block, when full
+            size_t used          = 0;  // Objects in the last block
+        };
+
+        struct destructor {
+            void* object;
+            void (*destroy)(void*);
+        };
+
+        std::unordered_map<std::type_index, pool> pools;
+        std::vector<destructor> destructors;
+        size_t objects  = 0;
+        size_t reserved = 0;
+};
+
+template <typename T, typename... Args>
+shared_ptr<T> make_scene_object(Args&&... args) {
+    // make_shared, or the current scene_arena's make while a scene_arena::scope is active.
+    if (auto arena = scene_arena::current())
+        return arena->make<T>(std::forward<Args>(args)...);
+    return make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
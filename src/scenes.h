@@ -0,0 +1,481 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtutils.h"
+
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "quad.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "texture.h"
+
+struct scene {
+    shared_ptr<scene_arena> arena;  // Owns the objects of world; first, so that it goes last
+    hittable_list           world;
+    camera                  cam;
+    hittable_list           lights;  // Emitters of world that the camera samples directly
+};
+
+// Scenes are built in a scene_arena unless this is false, which puts every object on the heap on
+// its own (for comparison in the benchmarks).
+bool build_scenes_in_arena = true;
+
+shared_ptr<scene_arena> new_scene_arena() {
+    return build_scenes_in_arena ? make_shared<scene_arena>() : nullptr;
+}
+
+scene bouncing_spheres(const bvh_build_options& bvh = {}) {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto checker = make_scene_object<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_scene_object<sphere>(point3(0,-1000,0), 1000, make_scene_object<lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_scene_object<lambertian>(albedo);
+                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
+                    world.add(make_scene_object<sphere>(center, center2, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_scene_object<metal>(albedo, fuzz);
+                    world.add(make_scene_object<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_scene_object<dielectric>(1.5);
+                    world.add(make_scene_object<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_scene_object<dielectric>(1.5);
+    world.add(make_scene_object<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_scene_object<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_scene_object<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_scene_object<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_scene_object<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    world = hittable_list(make_scene_object<linear_bvh>(world, bvh));
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 10.0;
+
+    return {arena, world, cam, hittable_list()};
+}
+
+scene checkered_spheres() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto checker = make_scene_object<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+
+    world.add(make_scene_object<sphere>(point3(0, -10, 0), 10, make_scene_object<lambertian>(checker)));
+    world.add(make_scene_object<sphere>(point3(0, 10, 0), 10, make_scene_object<lambertian>(checker)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat   = point3(0, 0, 0);
+    cam.vup      = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list()};
+}
+
+scene earth() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    auto earth_texture = make_scene_object<image_texture>("earthmap.jpg");
+    auto earth_surface = make_scene_object<lambertian>(earth_texture);
+    auto globe = make_scene_object<sphere>(point3(0,0,0), 2, earth_surface);
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(0,0,12);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, hittable_list(globe), cam, hittable_list()};
+}
+
+scene perlin_spheres() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto pertext = make_scene_object<noise_texture>(4);
+    world.add(make_scene_object<sphere>(point3(0, -1000, 0), 1000, make_scene_object<lambertian>(pertext)));
+    world.add(make_scene_object<sphere>(point3(0, 2, 0), 2, make_scene_object<lambertian>(pertext)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list()};
+}
+
+scene quads() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    // Materials
+    auto left_red     = make_scene_object<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_scene_object<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_scene_object<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_scene_object<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_scene_object<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(make_scene_object<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world.add(make_scene_object<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_scene_object<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_scene_object<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_scene_object<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 80;
+    cam.lookfrom = point3(0,0,9);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list()};
+}
+
+scene simple_light() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto pertext = make_scene_object<noise_texture>(4);
+    world.add(make_scene_object<sphere>(point3(0, -1000, 0), 1000, make_scene_object<lambertian>(pertext)));
+    world.add(make_scene_object<sphere>(point3(0, 2, 0), 2, make_scene_object<lambertian>(pertext)));
+
+    auto difflight = make_scene_object<diffuse_light>(color(4,4,4));
+    auto light_sphere = make_scene_object<sphere>(point3(0,7,0), 2, difflight);
+    auto light_quad = make_scene_object<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0, 2, 0), difflight);
+    world.add(light_sphere);
+    world.add(light_quad);
+
+    hittable_list lights;
+    lights.add(light_sphere);
+    lights.add(light_quad);
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0/ 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(26, 3, 6);
+    cam.lookat   = point3(0,2,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, lights};
+}
+
+scene cornell_box() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto red   = make_scene_object<lambertian>(color(.65, .05, .05));
+    auto white = make_scene_object<lambertian>(color(.73, .73, .73));
+    auto green = make_scene_object<lambertian>(color(.12, .45, .15));
+    auto light = make_scene_object<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_scene_object<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_scene_object<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    auto light_quad = make_scene_object<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), light);
+    world.add(light_quad);
+    world.add(make_scene_object<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_scene_object<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(make_scene_object<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_scene_object<rotate_y>(box1, 15);
+    box1 = make_scene_object<translate>(box1, vec3(265,0,295));
+    world.add(box1);
+
+    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_scene_object<rotate_y>(box2, -18);
+    box2 = make_scene_object<translate>(box2, vec3(130,0,65));
+    world.add(box2);
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat   = point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list(light_quad)};
+}
+
+scene cornell_smoke() {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list world;
+
+    auto red   = make_scene_object<lambertian>(color(.65, .05, .05));
+    auto white = make_scene_object<lambertian>(color(.73, .73, .73));
+    auto green = make_scene_object<lambertian>(color(.12, .45, .15));
+    auto light = make_scene_object<diffuse_light>(color(7, 7, 7));
+
+    world.add(make_scene_object<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_scene_object<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    auto light_quad = make_scene_object<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light);
+    world.add(light_quad);
+    world.add(make_scene_object<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_scene_object<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(make_scene_object<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_scene_object<rotate_y>(box1, 15);
+    box1 = make_scene_object<translate>(box1, vec3(265,0,295));
+
+    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_scene_object<rotate_y>(box2, -18);
+    box2 = make_scene_object<translate>(box2, vec3(130,0,65));
+
+    world.add(make_scene_object<constant_medium>(box1, 0.01, color(0,0,0)));
+    world.add(make_scene_object<constant_medium>(box2, 0.01, color(1,1,1)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat   = point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list(light_quad)};
+}
+
+scene obj_model(const std::string& filename) {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    // A Wavefront OBJ model under a sky, framed by its bounding box. An empty scene if the file
+    // does not load.
+    auto mesh = make_scene_object<triangle_mesh>(make_scene_object<lambertian>(color(0.73, 0.73, 0.73)));
+    hittable_list world;
+    if (load_obj(filename, *mesh)) {
+        mesh->build();
+        world.add(mesh);
+    }
+
+    auto bbox = world.bounding_box();
+    auto center = world.objects.empty() ? point3(0,0,0) : bvh_tree::centroid(bbox);
+    auto radius = world.objects.empty() ? 1.0
+                : 0.5 * vec3(bbox.x.size(), bbox.y.size(), bbox.z.size()).length();
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 40;
+    cam.lookfrom = center + radius * vec3(0.8, 0.8, 2.4);
+    cam.lookat   = center;
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list()};
+}
+
+scene final_scene(
+    int image_width, int samples_per_pixel, int max_depth, const bvh_build_options& bvh = {}
+) {
+    auto arena = new_scene_arena();
+    scene_arena::scope allocate_in(arena.get());
+
+    hittable_list boxes1;
+    auto ground = make_scene_object<lambertian>(color(0.48, 0.83, 0.53));
+    int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++ ) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1,101);
+            auto z1 = z0 + w;
+
+            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+        }
+    }
+
+    hittable_list world;
+
+    world.add(make_scene_object<linear_bvh>(boxes1, bvh));
+
+    auto light = make_scene_object<diffuse_light>(color(7, 7, 7));
+    auto light_quad = make_scene_object<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light);
+    world.add(light_quad);
+
+    auto center1 = point3(400, 400, 200);
+    auto center2 = center1 + vec3(30, 0, 0);
+    auto sphere_material = make_scene_object<lambertian>(color(0.7, 0.3, 0.1));
+    world.add(make_scene_object<sphere>(center1, center2, 50, sphere_material));
+
+    world.add(make_scene_object<sphere>(point3(260, 150, 45), 50, make_scene_object<dielectric>(1.5)));
+    world.add(make_scene_object<sphere>(
+        point3(0, 150, 145), 50, make_scene_object<metal>(color(0.8, 0.8, 0.9), 1.0)
+    ));
+
+    auto boundary = make_scene_object<sphere>(point3(360,150,145), 70, make_scene_object<dielectric>(1.5));
+    world.add(boundary);
+    world.add(make_scene_object<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    boundary = make_scene_object<sphere>(point3(0,0,0), 5000, make_scene_object<dielectric>(1.5));
+    world.add(make_scene_object<constant_medium>(boundary, .0001, color(1,1,1)));
+
+    auto emat = make_scene_object<lambertian>(make_scene_object<image_texture>("earthmap.jpg"));
+    world.add(make_scene_object<sphere>(point3(400,200,400), 100, emat));
+    auto pertext = make_scene_object<noise_texture>(0.2);
+    world.add(make_scene_object<sphere>(point3(220,280,300), 80, make_scene_object<lambertian>(pertext)));
+
+    auto boxes2 = make_scene_object<sphere_batch>();
+    auto white = make_scene_object<lambertian>(color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2->add(point3::random(0, 165), 10, white);
+    }
+
+    auto batch_options = sphere_batch_build_options();
+    batch_options.split = bvh.split;
+    boxes2->build(batch_options);
+
+    world.add(make_scene_object<instance>(
+        boxes2,
+        affine_transform::translation(vec3(-100,270,396)) * affine_transform::rotation(vec3(0,1,0), 15)
+    ));
+
+    camera cam;
+
+    cam.number_of_threads = 16;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth         = max_depth;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(478, 278, -600);
+    cam.lookat   = point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return {arena, world, cam, hittable_list(light_quad)};
+}
+
+#endif
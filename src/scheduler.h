@@ -0,0 +1,181 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct render_tile {
+    // Pixel bounds of the tile, [x0, x1) x [y0, y1)
+    int x0, y0;
+    int x1, y1;
+};
+
+struct work_item {
+    int tile;          // Index of the tile in the scheduler's tile list
+    int sample_begin;  // First sample index of the range
+    int sample_end;    // One past the last sample index of the range
+};
+
+class work_stealing_queue {
+    /* A double ended queue of work items. The owning worker pushes and pops at the back, idle
+       workers steal from the front, so the owner keeps working on items that are close together
+       in the image while thieves take the ones furthest away from it. */
+    public:
+        void push(const work_item& item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(item);
+        }
+
+        bool pop(work_item& item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty())
+                return false;
+
+            item = items.back();
+            items.pop_back();
+            return true;
+        }
+
+        bool steal(work_item& item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty())
+                return false;
+
+            item = items.front();
+            items.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<work_item> items;
+};
+
+class work_scheduler {
+    public:
+        work_scheduler(int worker_count) : queues(worker_count), steals(worker_count, 0) {}
+
+        int worker_count() const { return int(queues.size()); }
+
+        void distribute(const std::vector<work_item>& items) {
+            // Hand each worker a contiguous block of items, so its own queue stays spatially
+            // coherent. Any imbalance between the blocks is evened out by stealing.
+            auto count = items.size();
+            auto workers = queues.size();
+
+            for (size_t w = 0; w < workers; w++) {
+                auto begin = count * w / workers;
+                auto end   = count * (w+1) / workers;
+
+                // Push in reverse so the owner pops its block in image order.
+                for (auto i = end; i > begin; i--)
+                    queues[w].push(items[i-1]);
+            }
+        }
+
+        bool next(int worker, work_item& item) {
+            // Returns false once every queue has run dry. No items are produced while rendering,
+            // so a failed sweep over all the queues means the work is done.
+            if (queues[worker].pop(item))
+                return true;
+
+            auto workers = int(queues.size());
+            for (int k = 1; k < workers; k++) {
+                if (queues[(worker + k) % workers].steal(item)) {
+                    steals[worker]++;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        int steal_count(int worker) const { return steals[worker]; }
+
+    private:
+        std::vector<work_stealing_queue> queues;
+        std::vector<int> steals;  // Only written by the owning worker
+};
+
+struct tile_timing {
+    int    tile;
+    double seconds;
+};
+
+class tile_report {
+    /* Collects wall time per work item from every worker and summarizes it per tile, so load
+       imbalance across the image can be inspected after a render. */
+    public:
+        tile_report(const std::vector<render_tile>& tiles, int worker_count)
+            : tiles(tiles), timings(worker_count), busy(worker_count, 0.0) {}
+
+        void record(int worker, int tile, double seconds) {
+            // Each worker only touches its own slot, so no synchronization is needed.
+            timings[worker].push_back({tile, seconds});
+            busy[worker] += seconds;
+        }
+
+        std::vector<double> tile_seconds() const {
+            std::vector<double> totals(tiles.size(), 0.0);
+            for (const auto& worker_timings : timings)
+                for (const auto& t : worker_timings)
+                    totals[t.tile] += t.seconds;
+            return totals;
+        }
+
+        void print(std::ostream& out, const work_scheduler& scheduler, double wall_seconds) const {
+            auto totals = tile_seconds();
+            if (totals.empty())
+                return;
+
+            auto sorted = totals;
+            std::sort(sorted.begin(), sorted.end());
+
+            double sum = 0;
+            for (auto s : sorted)
+                sum += s;
+            auto mean = sum / sorted.size();
+
+            out << "Tiles: " << tiles.size()
+                << "  min " << 1000 * sorted.front() << " ms"
+                << "  median " << 1000 * sorted[sorted.size()/2] << " ms"
+                << "  max " << 1000 * sorted.back() << " ms"
+                << "  max/mean " << (mean > 0 ? sorted.back() / mean : 0) << '\n';
+
+            for (int w = 0; w < int(busy.size()); w++) {
+                out << "  worker " << w
+                    << ": busy " << busy[w] << " s"
+                    << " (" << (wall_seconds > 0 ? 100 * busy[w] / wall_seconds : 0) << "%)"
+                    << ", items " << timings[w].size()
+                    << ", stolen " << scheduler.steal_count(w) << '\n';
+            }
+        }
+
+        bool write_csv(const std::string& path) const {
+            // One line per tile: pixel bounds and the summed wall time of all its work items.
+            std::ofstream file(path);
+            if (!file)
+                return false;
+
+            auto totals = tile_seconds();
+            file << "tile,x0,y0,x1,y1,ms\n";
+            for (size_t i = 0; i < tiles.size(); i++) {
+                const auto& t = tiles[i];
+                file << i << ',' << t.x0 << ',' << t.y0 << ',' << t.x1 << ',' << t.y1 << ','
+                     << 1000 * totals[i] << '\n';
+            }
+            return true;
+        }
+
+    private:
+        std::vector<render_tile> tiles;
+        std::vector<std::vector<tile_timing>> timings;
+        std::vector<double> busy;
+};
+
+#endif
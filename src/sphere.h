@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "onb.h"
 
 class sphere : public hittable {
     public: 
@@ -25,6 +26,7 @@ class sphere : public hittable {
 
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_COUNT(sphere_tests);
             point3 current_center = center.at(r.time());
             vec3 oc = current_center - r.origin();
             auto a = r.direction().length_squared();
@@ -46,25 +48,104 @@ class sphere : public hittable {
                     return false;
             }
 
-            rec.t = root;
-            rec.p = r.at(rec.t);
-            //for a sphere, divifing by radius will normalize
-            vec3 outward_normal = (rec.p - current_center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv(outward_normal, rec.u, rec.v);
-            rec.mat = mat;
-
+            set_hit_record(r, root, rec);
             return true;
         }
 
+        uint32_t hit_packet(ray_packet& rays, uint32_t mask, packet_hits& hits) const override {
+            // A lone ray is cheaper through the scalar test than through a full packet pass.
+            if (lane_count(mask) < 2)
+                return hittable::hit_packet(rays, mask, hits);
+
+            /* The root is found for all lanes without branches, so the loop vectorizes; only the
+               lanes that hit go on to fill in a hit record (with its normal and uv). */
+            RT_COUNT_N(sphere_tests, lane_count(mask));
+            double roots[ray_packet::max_size];
+            auto c0 = center.origin(), c1 = center.direction();
+
+            for (int lane = 0; lane < rays.size; lane++) {
+                auto ocx = c0.x() + rays.time[lane]*c1.x() - rays.ox[lane];
+                auto ocy = c0.y() + rays.time[lane]*c1.y() - rays.oy[lane];
+                auto ocz = c0.z() + rays.time[lane]*c1.z() - rays.oz[lane];
+                auto a = rays.dx[lane]*rays.dx[lane] + rays.dy[lane]*rays.dy[lane] + rays.dz[lane]*rays.dz[lane];
+                auto h = rays.dx[lane]*ocx + rays.dy[lane]*ocy + rays.dz[lane]*ocz;
+                auto c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+
+                auto discriminant = h*h - a*c;
+                auto sqrtd = std::sqrt(std::fmax(discriminant, 0.0));
+                auto near_root = (h - sqrtd) / a;
+                auto far_root = (h + sqrtd) / a;
+                auto tmin = rays.t_min[lane], tmax = rays.t_max[lane];
+
+                auto root = (tmin < near_root && near_root < tmax) ? near_root : far_root;
+                roots[lane] = (discriminant >= 0 && tmin < root && root < tmax) ? root : -infinity;
+            }
+
+            uint32_t hit_mask = 0;
+            for (int lane = 0; lane < rays.size; lane++) {
+                if ((mask & (1u << lane)) && roots[lane] != -infinity) {
+                    set_hit_record(rays.get(lane), roots[lane], hits.rec[lane]);
+                    rays.t_max[lane] = roots[lane];
+                    hit_mask |= 1u << lane;
+                }
+            }
+            return hit_mask;
+        }
+
         aabb bounding_box() const override { return bbox; }
 
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            // Uniform over the cone of directions that see the sphere. A moving sphere is sampled
+            // where it is at time 0.
+            hit_record rec;
+            if (!this->hit(ray(origin, direction, 0), interval(0.001, infinity), rec))
+                return 0;
+
+            auto distance_squared = (center.at(0) - origin).length_squared();
+            auto cos_theta_max = std::sqrt(std::fmax(0, 1 - radius*radius/distance_squared));
+            auto solid_angle = 2*pi*(1 - cos_theta_max);
+            return 1 / solid_angle;
+        }
+
+        vec3 random(const point3& origin) const override {
+            vec3 direction = center.at(0) - origin;
+            auto distance_squared = direction.length_squared();
+            onb uvw(direction);
+            return uvw.transform(random_to_sphere(radius, distance_squared));
+        }
+
     private:
         ray center;
         double radius;
         shared_ptr<material> mat;
         aabb bbox;
 
+        void set_hit_record(const ray& r, double root, hit_record& rec) const {
+            point3 current_center = center.at(r.time());
+            rec.t = root;
+            rec.p = r.at(rec.t);
+            //for a sphere, divifing by radius will normalize
+            vec3 outward_normal = (rec.p - current_center) / radius;
+            rec.set_face_normal(r, outward_normal);
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+            rec.mat = mat.get();
+        }
+
+        static vec3 random_to_sphere(double radius, double distance_squared) {
+            // A direction about +z, uniform over the cone around a sphere of the given radius at
+            // the given squared distance.
+            auto r1 = random_double();
+            auto r2 = random_double();
+            auto cos_theta_max = std::sqrt(std::fmax(0, 1 - radius*radius/distance_squared));
+            auto z = 1 + r2*(cos_theta_max - 1);
+
+            auto phi = 2*pi*r1;
+            auto x = std::cos(phi) * std::sqrt(1 - z*z);
+            auto y = std::sin(phi) * std::sqrt(1 - z*z);
+
+            return vec3(x, y, z);
+        }
+
         static void get_sphere_uv(const point3& p, double& u, double& v) {
             // p: a given point on the sphere of radius one, centered at the origin,
             // u: returned value [0, 1] of angle from the Y axis from X = -1,
@@ -0,0 +1,267 @@
+#ifndef SPHERE_BATCH_H
+#define SPHERE_BATCH_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+inline bvh_build_options sphere_batch_build_options() {
+    // Leaves test several spheres per vector instruction, so they are made larger and cheaper
+    // for the SAH than leaves of individual sphere objects.
+    bvh_build_options options;
+    options.max_leaf_size     = 8;
+    options.intersection_cost = 0.25;
+    return options;
+}
+
+class sphere_batch : public hittable {
+    /* Many spheres as one hittable. Centers, motion and radii are stored as structure of arrays
+       in BVH leaf order, so a leaf is tested against several spheres per vector instruction, and
+       only the closest hit fills in a hit record (normal, uv and material). Materials are shared
+       through an index into a table of distinct materials rather than a shared_ptr per sphere.
+
+       Add the spheres, then call build() once before the batch is hit. */
+    public:
+        // Stationary sphere
+        void add(const point3& center, double radius, shared_ptr<material> mat) {
+            add(center, center, radius, mat);
+        }
+
+        // Moving sphere, from center1 at time 0 to center2 at time 1
+        void add(const point3& center1, const point3& center2, double radius, shared_ptr<material> mat) {
+            cx.push_back(center1.x());  mx.push_back(center2.x() - center1.x());
+            cy.push_back(center1.y());  my.push_back(center2.y() - center1.y());
+            cz.push_back(center1.z());  mz.push_back(center2.z() - center1.z());
+            radii.push_back(std::fmax(0, radius));
+
+            auto [entry, inserted] = material_index.emplace(mat.get(), uint32_t(materials.size()));
+            if (inserted)
+                materials.push_back(mat);
+            material_ids.push_back(entry->second);
+            sphere_count++;
+        }
+
+        void build(const bvh_build_options& options = sphere_batch_build_options()) {
+            std::vector<aabb> bounds(size());
+            for (size_t i = 0; i < size(); i++) {
+                auto rvec = vec3(radii[i], radii[i], radii[i]);
+                auto c0 = point3(cx[i], cy[i], cz[i]);
+                auto c1 = c0 + vec3(mx[i], my[i], mz[i]);
+                bounds[i] = aabb(aabb(c0 - rvec, c0 + rvec), aabb(c1 - rvec, c1 + rvec));
+            }
+
+            tree.build(bounds, options);
+
+            // Reorder the spheres into leaf order, so every leaf is a contiguous run.
+            auto reorder = [&](auto& values) {
+                auto sorted = values;
+                for (size_t i = 0; i < tree.indices.size(); i++)
+                    sorted[i] = values[tree.indices[i]];
+                values = std::move(sorted);
+            };
+            reorder(cx); reorder(cy); reorder(cz);
+            reorder(mx); reorder(my); reorder(mz);
+            reorder(radii);
+            reorder(material_ids);
+
+            // Pad by a vector's worth of lanes, so that a vector load starting at the last sphere
+            // stays inside the arrays. Lanes past the end of a leaf are masked off.
+            auto padded = sphere_count + 3;
+            for (auto* values : {&cx, &cy, &cz, &mx, &my, &mz, &radii}) {
+                values->resize(padded, 0.0);
+                values->shrink_to_fit();
+            }
+            material_ids.resize(padded, 0);
+            material_ids.shrink_to_fit();
+        }
+
+        size_t size() const { return sphere_count; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // Only the closest sphere is remembered during traversal; its hit record is filled in
+            // once at the end.
+            int64_t closest = -1;
+            double closest_t = 0;
+
+            tree.traverse_leaves(r, ray_t, [&](uint32_t first, uint32_t count, interval& t) {
+                auto i = hit_leaf(r, t, first, count);
+                if (i < 0)
+                    return false;
+                closest = i;
+                closest_t = t.max;
+                return true;
+            });
+
+            if (closest < 0)
+                return false;
+
+            set_hit_record(r, closest_t, size_t(closest), rec);
+            return true;
+        }
+
+        aabb bounding_box() const override { return tree.bounding_box(); }
+
+        const bvh_build_report& build_report() const { return tree.build_report(); }
+
+        size_t memory_bytes() const {
+            // Spheres, material table and hierarchy, not counting the materials themselves.
+            return (cx.capacity() + cy.capacity() + cz.capacity() + mx.capacity() + my.capacity()
+                    + mz.capacity() + radii.capacity()) * sizeof(double)
+                 + material_ids.capacity() * sizeof(uint32_t)
+                 + materials.capacity() * sizeof(shared_ptr<material>)
+                 + tree.nodes.capacity() * sizeof(linear_bvh_node)
+                 + tree.indices.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        std::vector<double>   cx, cy, cz;    // Center at time 0
+        std::vector<double>   mx, my, mz;    // Motion from time 0 to time 1
+        std::vector<double>   radii;
+        std::vector<uint32_t> material_ids;  // Index into materials
+
+        std::vector<shared_ptr<material>> materials;
+        std::unordered_map<const material*, uint32_t> material_index;
+
+        bvh_tree tree;
+        size_t sphere_count = 0;  // Number of spheres, not counting the padding added by build()
+
+        int64_t hit_leaf(const ray& r, interval& ray_t, uint32_t first, uint32_t count) const {
+            /* Tests the spheres [first, first + count) against the ray and returns the closest one
+               hit within ray_t (shrinking ray_t.max to it), or -1. The quadratic is solved for a
+               vector of spheres at a time: four with AVX, two with SSE2, one otherwise. */
+            RT_COUNT_N(sphere_tests, count);
+            const auto& o = r.origin();
+            const auto& d = r.direction();
+            auto a = d.length_squared();
+            auto inv_a = 1 / a;
+            auto tm = r.time();
+            int64_t closest = -1;
+
+#if defined(__AVX__) || defined(__SSE2__)
+#if defined(__AVX__)
+            using vec = __m256d;
+            const uint32_t lanes = 4;
+            auto load  = [](const double* p) { return _mm256_loadu_pd(p); };
+            auto splat = [](double x) { return _mm256_set1_pd(x); };
+            auto add   = [](vec x, vec y) { return _mm256_add_pd(x, y); };
+            auto sub   = [](vec x, vec y) { return _mm256_sub_pd(x, y); };
+            auto mul   = [](vec x, vec y) { return _mm256_mul_pd(x, y); };
+            auto max   = [](vec x, vec y) { return _mm256_max_pd(x, y); };
+            auto sqrt  = [](vec x) { return _mm256_sqrt_pd(x); };
+            auto blend = [](vec x, vec y, vec m) { return _mm256_blendv_pd(x, y, m); };
+            auto less  = [](vec x, vec y) { return _mm256_cmp_pd(x, y, _CMP_LT_OQ); };
+            auto not_less = [](vec x, vec y) { return _mm256_cmp_pd(x, y, _CMP_GE_OQ); };
+            auto both  = [](vec x, vec y) { return _mm256_and_pd(x, y); };
+            auto bits  = [](vec m) { return uint32_t(_mm256_movemask_pd(m)); };
+            auto store = [](double* p, vec x) { _mm256_storeu_pd(p, x); };
+#else
+            using vec = __m128d;
+            const uint32_t lanes = 2;
+            auto load  = [](const double* p) { return _mm_loadu_pd(p); };
+            auto splat = [](double x) { return _mm_set1_pd(x); };
+            auto add   = [](vec x, vec y) { return _mm_add_pd(x, y); };
+            auto sub   = [](vec x, vec y) { return _mm_sub_pd(x, y); };
+            auto mul   = [](vec x, vec y) { return _mm_mul_pd(x, y); };
+            auto max   = [](vec x, vec y) { return _mm_max_pd(x, y); };
+            auto sqrt  = [](vec x) { return _mm_sqrt_pd(x); };
+            auto blend = [](vec x, vec y, vec m) { return _mm_or_pd(_mm_andnot_pd(m, x), _mm_and_pd(m, y)); };
+            auto less  = [](vec x, vec y) { return _mm_cmplt_pd(x, y); };
+            auto not_less = [](vec x, vec y) { return _mm_cmpge_pd(x, y); };
+            auto both  = [](vec x, vec y) { return _mm_and_pd(x, y); };
+            auto bits  = [](vec m) { return uint32_t(_mm_movemask_pd(m)); };
+            auto store = [](double* p, vec x) { _mm_storeu_pd(p, x); };
+#endif
+            auto ox = splat(o.x()), oy = splat(o.y()), oz = splat(o.z());
+            auto dx = splat(d.x()), dy = splat(d.y()), dz = splat(d.z());
+            auto time = splat(tm), va = splat(a), vinv_a = splat(inv_a), zero = splat(0);
+
+            for (uint32_t g = first; g < first + count; g += lanes) {
+                auto ocx = sub(add(load(&cx[g]), mul(time, load(&mx[g]))), ox);
+                auto ocy = sub(add(load(&cy[g]), mul(time, load(&my[g]))), oy);
+                auto ocz = sub(add(load(&cz[g]), mul(time, load(&mz[g]))), oz);
+                auto radius = load(&radii[g]);
+
+                auto h = add(add(mul(dx, ocx), mul(dy, ocy)), mul(dz, ocz));
+                auto c = sub(add(add(mul(ocx, ocx), mul(ocy, ocy)), mul(ocz, ocz)), mul(radius, radius));
+                auto discriminant = sub(mul(h, h), mul(va, c));
+                auto sqrtd = sqrt(max(discriminant, zero));
+
+                auto tmin = splat(ray_t.min), tmax = splat(ray_t.max);
+                auto near_root = mul(sub(h, sqrtd), vinv_a);
+                auto far_root  = mul(add(h, sqrtd), vinv_a);
+                auto near_ok = both(less(tmin, near_root), less(near_root, tmax));
+                auto root = blend(far_root, near_root, near_ok);
+
+                auto valid = both(not_less(discriminant, zero), both(less(tmin, root), less(root, tmax)));
+
+                auto mask = bits(valid);
+                if (g + lanes > first + count)
+                    mask &= (1u << (first + count - g)) - 1;
+                if (!mask)
+                    continue;
+
+                double roots[lanes];
+                store(roots, root);
+                for (; mask; mask &= mask - 1) {
+                    auto lane = first_lane(mask);
+                    if (roots[lane] < ray_t.max) {
+                        ray_t.max = roots[lane];
+                        closest = g + lane;
+                    }
+                }
+            }
+#else
+            for (uint32_t i = first; i < first + count; i++) {
+                auto ocx = cx[i] + tm*mx[i] - o.x();
+                auto ocy = cy[i] + tm*my[i] - o.y();
+                auto ocz = cz[i] + tm*mz[i] - o.z();
+                auto h = d.x()*ocx + d.y()*ocy + d.z()*ocz;
+                auto c = ocx*ocx + ocy*ocy + ocz*ocz - radii[i]*radii[i];
+
+                auto discriminant = h*h - a*c;
+                if (discriminant < 0)
+                    continue;
+
+                auto sqrtd = std::sqrt(discriminant);
+                auto root = (h - sqrtd) * inv_a;
+                if (!ray_t.surrounds(root)) {
+                    root = (h + sqrtd) * inv_a;
+                    if (!ray_t.surrounds(root))
+                        continue;
+                }
+
+                ray_t.max = root;
+                closest = i;
+            }
+#endif
+            return closest;
+        }
+
+        void set_hit_record(const ray& r, double t, size_t i, hit_record& rec) const {
+            auto current_center = point3(cx[i], cy[i], cz[i]) + r.time() * vec3(mx[i], my[i], mz[i]);
+            rec.t = t;
+            rec.p = r.at(t);
+            vec3 outward_normal = (rec.p - current_center) / radii[i];
+            rec.set_face_normal(r, outward_normal);
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+            rec.mat = materials[material_ids[i]].get();
+        }
+
+        static void get_sphere_uv(const point3& p, double& u, double& v) {
+            // Same mapping as sphere::get_sphere_uv.
+            auto theta = std::acos(-p.y());
+            auto phi = std::atan2(-p.z(), p.x()) + pi;
+
+            u = phi / (2*pi);
+            v = theta / pi;
+        }
+};
+
+#endif
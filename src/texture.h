@@ -4,21 +4,36 @@
 #include "perlin.h"
 #include "rtw_stb_image.h"
 
+#include <cstdint>
+
+
+enum class texture_kind : uint8_t { solid_color, checker, image, noise };
 
 class texture {
+    /* The set of textures is closed: every texture carries its kind, and value() switches on it
+       and calls the final class directly, so a lookup costs no virtual call and the small ones
+       inline into the material. */
     public:
         virtual ~texture() = default;
 
-        virtual color value(double u, double v, const point3& p) const = 0;
+        texture_kind kind() const { return texture_kind_; }
+
+        color value(double u, double v, const point3& p) const;
+
+    protected:
+        texture(texture_kind kind) : texture_kind_(kind) {}
+
+    private:
+        texture_kind texture_kind_;
 };
 
-class solid_color : public texture {
+class solid_color final : public texture {
     public:
-        solid_color(const color& albedo) : albedo(albedo) {}
+        solid_color(const color& albedo) : texture(texture_kind::solid_color), albedo(albedo) {}
 
         solid_color(double red, double green, double blue) : solid_color(color(red,green,blue)) {}
 
-        color value(double u, double v, const point3& p) const override {
+        color value(double u, double v, const point3& p) const {
             return albedo;
         }
 
@@ -26,22 +41,27 @@ class solid_color : public texture {
         color albedo;
 };
 
-class checker_texture : public texture {
+class checker_texture final : public texture {
     public:
         checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd) 
-            : inv_scale(1.0 / scale), even(even), odd(odd) {}
+            : texture(texture_kind::checker), inv_scale(1.0 / scale), even(even), odd(odd) {}
 
         checker_texture(double scale, const color& c1, const color& c2) 
-            : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+            : checker_texture(scale, make_scene_object<solid_color>(c1), make_scene_object<solid_color>(c2)) {}
+
+        color value(double u, double v, const point3& p) const {
+            return select(p)->value(u, v, p);
+        }
 
-        color value(double u, double v, const point3& p) const override {
+        const texture* select(const point3& p) const {
+            // The even or odd texture, whichever covers p.
             auto xInteger = int(std::floor(inv_scale * p.x()));
             auto yInteger = int(std::floor(inv_scale * p.y()));
             auto zInteger = int(std::floor(inv_scale * p.z()));
 
             bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-            return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+            return isEven ? even.get() : odd.get();
         }
         
     private:
@@ -50,11 +70,11 @@ class checker_texture : public texture {
         shared_ptr<texture> odd;
 };
 
-class image_texture : public texture {
+class image_texture final : public texture {
     public:
-        image_texture(const char* filename) : image(filename) {}
+        image_texture(const char* filename) : texture(texture_kind::image), image(filename) {}
 
-        color value(double u, double v, const point3& p) const override {
+        color value(double u, double v, const point3& p) const {
             // If we haev no texture data, then reutrn solid cyan as a debugging aid/
             if (image.height() <= 0) return color(0, 1, 1);
 
@@ -74,11 +94,11 @@ class image_texture : public texture {
         rtw_image image;
 };
 
-class noise_texture : public texture {
+class noise_texture final : public texture {
     public:
-        noise_texture(double scale) : scale(scale) {}
+        noise_texture(double scale) : texture(texture_kind::noise), scale(scale) {}
 
-        color value(double u, double v, const point3& p) const override {
+        color value(double u, double v, const point3& p) const {
             return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
         }
 
@@ -87,4 +107,19 @@ class noise_texture : public texture {
         double scale;
 };
 
+inline color texture::value(double u, double v, const point3& p) const {
+    // Nested checkers are walked in a loop rather than by recursion, down to the texture that
+    // covers p.
+    auto tex = this;
+    while (tex->kind() == texture_kind::checker)
+        tex = static_cast<const checker_texture*>(tex)->select(p);
+
+    switch (tex->kind()) {
+        case texture_kind::solid_color: return static_cast<const solid_color*>(tex)->value(u, v, p);
+        case texture_kind::image:       return static_cast<const image_texture*>(tex)->value(u, v, p);
+        case texture_kind::noise:       return static_cast<const noise_texture*>(tex)->value(u, v, p);
+        default:                        return color(0,0,0);
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,250 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+struct mesh_uv {
+    double u, v;
+};
+
+class triangle_mesh : public hittable {
+    /* An indexed triangle mesh as one hittable. Vertex positions, normals and texture coordinates
+       live in shared buffers; each triangle holds three indices into each buffer, so vertices are
+       stored once however many triangles use them. Normals and texture coordinates are optional:
+       without normals the geometric normal is used, without texture coordinates (u, v) are the
+       barycentric coordinates of the hit.
+
+       Fill the buffers (by hand or with load_obj), then call build() once before the mesh is hit.
+       build() puts the triangles in the leaf order of the mesh's own BVH. */
+    public:
+        std::vector<point3>  positions;
+        std::vector<vec3>    normals;
+        std::vector<mesh_uv> uvs;
+
+        // Three entries per triangle. normal_indices and uv_indices are either empty or the same
+        // size as position_indices.
+        std::vector<uint32_t> position_indices;
+        std::vector<uint32_t> normal_indices;
+        std::vector<uint32_t> uv_indices;
+
+        triangle_mesh(shared_ptr<material> mat) : mat(mat) {}
+
+        void add_triangle(uint32_t v0, uint32_t v1, uint32_t v2) {
+            position_indices.insert(position_indices.end(), {v0, v1, v2});
+        }
+
+        size_t triangle_count() const { return position_indices.size() / 3; }
+
+        void build(const bvh_build_options& options = {}) {
+            auto count = triangle_count();
+            if (normal_indices.size() != position_indices.size())
+                normal_indices.clear();
+            if (uv_indices.size() != position_indices.size())
+                uv_indices.clear();
+
+            // Triangle boxes are widened by a tiny fraction of the mesh's size. A ray through a
+            // vertex or along an edge can touch a box in a single point, and a box test that
+            // rounds the wrong way would then undo the watertight triangle test.
+            double scale = 0;
+            for (const auto& p : positions)
+                scale = std::fmax(scale, std::fmax(std::fabs(p.x()), std::fmax(std::fabs(p.y()), std::fabs(p.z()))));
+            auto pad = 1e-9 * scale;
+
+            std::vector<aabb> bounds(count);
+            for (size_t i = 0; i < count; i++) {
+                const auto& p0 = positions[position_indices[3*i]];
+                const auto& p1 = positions[position_indices[3*i + 1]];
+                const auto& p2 = positions[position_indices[3*i + 2]];
+                auto box = aabb(aabb(p0, p1), aabb(p0, p2));
+                bounds[i] = aabb(box.x.expand(pad), box.y.expand(pad), box.z.expand(pad));
+            }
+
+            tree.build(bounds, options);
+
+            // Reorder the triangles into leaf order, so every leaf is a contiguous run.
+            auto reorder = [&](std::vector<uint32_t>& values) {
+                if (values.empty())
+                    return;
+                std::vector<uint32_t> sorted(values.size());
+                for (size_t i = 0; i < tree.indices.size(); i++) {
+                    auto source = 3 * size_t(tree.indices[i]);
+                    sorted[3*i]     = values[source];
+                    sorted[3*i + 1] = values[source + 1];
+                    sorted[3*i + 2] = values[source + 2];
+                }
+                values = std::move(sorted);
+                values.shrink_to_fit();
+            };
+            reorder(position_indices);
+            reorder(normal_indices);
+            reorder(uv_indices);
+
+            positions.shrink_to_fit();
+            normals.shrink_to_fit();
+            uvs.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // Only the closest triangle and its barycentric coordinates are remembered during
+            // traversal; the hit record is filled in once at the end.
+            auto wr = watertight_ray(r);
+            triangle_hit closest;
+
+            tree.traverse_leaves(r, ray_t, [&](uint32_t first, uint32_t count, interval& t) {
+                return hit_leaf(wr, t, first, count, closest);
+            });
+
+            if (closest.index < 0)
+                return false;
+
+            set_hit_record(r, closest, rec);
+            return true;
+        }
+
+        aabb bounding_box() const override { return tree.bounding_box(); }
+
+        const bvh_build_report& build_report() const { return tree.build_report(); }
+
+        size_t memory_bytes() const {
+            // Vertex buffers, triangle indices and hierarchy, not counting the material.
+            return positions.capacity() * sizeof(point3)
+                 + normals.capacity() * sizeof(vec3)
+                 + uvs.capacity() * sizeof(mesh_uv)
+                 + (position_indices.capacity() + normal_indices.capacity() + uv_indices.capacity())
+                   * sizeof(uint32_t)
+                 + tree.nodes.capacity() * sizeof(linear_bvh_node)
+                 + tree.indices.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        shared_ptr<material> mat;
+        bvh_tree tree;
+
+        struct watertight_ray {
+            /* Per ray constants of the watertight test (Woop, Benthin and Wald, "Watertight
+               Ray/Triangle Intersection", JCGT 2013). The axis along which the direction is
+               largest becomes z, and the shear (sx, sy, sz) maps the ray onto the +z axis, so
+               each triangle is tested with 2D edge functions that give the same answer for an
+               edge from both of its triangles: no ray slips between neighbours. */
+            point3 origin;
+            int    kx, ky, kz;
+            double sx, sy, sz;
+
+            watertight_ray(const ray& r) : origin(r.origin()) {
+                const auto& d = r.direction();
+                kz = std::fabs(d.x()) > std::fabs(d.y())
+                   ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2)
+                   : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+                kx = (kz + 1) % 3;
+                ky = (kx + 1) % 3;
+                if (d[kz] < 0)  // Keep the winding of the triangles
+                    std::swap(kx, ky);
+
+                sx = d[kx] / d[kz];
+                sy = d[ky] / d[kz];
+                sz = 1.0 / d[kz];
+            }
+        };
+
+        struct triangle_hit {
+            int64_t index = -1;       // Triangle, -1 if nothing was hit
+            double  t = 0;
+            double  b0 = 0, b1 = 0, b2 = 0;  // Barycentric weights of the three vertices
+        };
+
+        bool hit_leaf(
+            const watertight_ray& wr, interval& ray_t, uint32_t first, uint32_t count, triangle_hit& closest
+        ) const {
+            /* Tests the triangles [first, first + count), shrinking ray_t.max to the closest hit.
+               The test has no early outs besides the final comparison, so the compiler can keep
+               it in registers and if-convert it. The division is deferred until a hit is known
+               to be closer. */
+            RT_COUNT_N(triangle_tests, count);
+            bool hit_anything = false;
+
+            for (auto i = first; i < first + count; i++) {
+                auto ia = position_indices[3*i], ib = position_indices[3*i + 1], ic = position_indices[3*i + 2];
+                auto a = positions[ia] - wr.origin;
+                auto b = positions[ib] - wr.origin;
+                auto c = positions[ic] - wr.origin;
+
+                auto ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+                auto bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+                auto cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+                // Edge functions: the ray passes inside if all three have the same sign. Each edge
+                // is evaluated from its lower numbered vertex, so the two triangles sharing it get
+                // exactly opposite values even when the compiler fuses a multiply and subtract.
+                auto edge = [](uint32_t i0, double x0, double y0, uint32_t i1, double x1, double y1) {
+                    return i0 < i1 ? x0*y1 - y0*x1 : -(x1*y0 - y1*x0);
+                };
+                auto u = edge(ic, cx, cy, ib, bx, by);
+                auto v = edge(ia, ax, ay, ic, cx, cy);
+                auto w = edge(ib, bx, by, ia, ax, ay);
+
+                auto det = u + v + w;
+                auto t_scaled = wr.sz * (u*a[wr.kz] + v*b[wr.kz] + w*c[wr.kz]);
+
+                // Same signs, a non-degenerate triangle and ray_t.min < t < ray_t.max, with both
+                // sides of the interval comparisons multiplied by det.
+                auto outside = (u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0);
+                auto in_range = det > 0
+                    ? (t_scaled > ray_t.min * det && t_scaled < ray_t.max * det)
+                    : (t_scaled < ray_t.min * det && t_scaled > ray_t.max * det);
+                if (outside || det == 0 || !in_range)
+                    continue;
+
+                auto inv_det = 1 / det;
+                ray_t.max = t_scaled * inv_det;
+                closest = {int64_t(i), ray_t.max, u * inv_det, v * inv_det, w * inv_det};
+                hit_anything = true;
+            }
+
+            return hit_anything;
+        }
+
+        void set_hit_record(const ray& r, const triangle_hit& h, hit_record& rec) const {
+            auto i = 3 * size_t(h.index);
+            const auto& p0 = positions[position_indices[i]];
+            const auto& p1 = positions[position_indices[i + 1]];
+            const auto& p2 = positions[position_indices[i + 2]];
+
+            rec.t = h.t;
+            rec.p = r.at(h.t);
+            rec.mat = mat.get();
+
+            // The face is decided by the geometric normal; an interpolated normal only shades,
+            // turned to the same side.
+            auto geometric_normal = unit_vector(cross(p1 - p0, p2 - p0));
+            rec.set_face_normal(r, geometric_normal);
+
+            if (!normal_indices.empty()) {
+                auto shading_normal = h.b0 * normals[normal_indices[i]]
+                                    + h.b1 * normals[normal_indices[i + 1]]
+                                    + h.b2 * normals[normal_indices[i + 2]];
+                if (shading_normal.length_squared() > 0) {
+                    shading_normal = unit_vector(shading_normal);
+                    if (dot(shading_normal, rec.normal) < 0)
+                        shading_normal = -shading_normal;
+                    rec.normal = shading_normal;
+                }
+            }
+
+            if (!uv_indices.empty()) {
+                const auto& uv0 = uvs[uv_indices[i]];
+                const auto& uv1 = uvs[uv_indices[i + 1]];
+                const auto& uv2 = uvs[uv_indices[i + 2]];
+                rec.u = h.b0 * uv0.u + h.b1 * uv1.u + h.b2 * uv2.u;
+                rec.v = h.b0 * uv0.v + h.b1 * uv1.v + h.b2 * uv2.v;
+            } else {
+                rec.u = h.b1;
+                rec.v = h.b2;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "hittable.h"
+#include "material.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct wavefront_path {
+    ray      r;            // Next ray of the path
+    color    throughput;   // Product of the attenuations so far
+    color    radiance;     // Light gathered so far
+    uint32_t pixel;        // Index of the pixel in the work item's tile
+    double   scatter_pdf;  // Density with which the last bounce picked r, for MIS (0 if it has none)
+};
+
+class wavefront_queues {
+    /* The ray queues of the wavefront integrator, kept by a render worker across work items so
+       they are only allocated once. paths holds every path still alive; hits[k] and alive[k]
+       belong to paths[k] during a bounce. bin_by_material() counting-sorts the paths that hit
+       something by the kind of material they hit, so each kind is shaded in one run of the same
+       code, and compact() drops the paths that ended while keeping the others in order. */
+    public:
+        std::vector<wavefront_path> paths;
+        std::vector<hit_record>     hits;
+        std::vector<char>           alive;
+
+        void begin_bounce() {
+            hits.resize(paths.size());
+            alive.assign(paths.size(), 0);
+        }
+
+        void bin_by_material() {
+            // Only paths that are alive (they hit something) are binned.
+            std::array<uint32_t, material_kind_count + 1> counts{};
+            for (size_t k = 0; k < paths.size(); k++)
+                if (alive[k])
+                    counts[size_t(hits[k].mat->kind()) + 1]++;
+
+            for (int kind = 0; kind < material_kind_count; kind++)
+                counts[kind + 1] += counts[kind];
+            bin_begin = counts;
+
+            binned.resize(counts[material_kind_count]);
+            for (size_t k = 0; k < paths.size(); k++)
+                if (alive[k])
+                    binned[counts[size_t(hits[k].mat->kind())]++] = uint32_t(k);
+        }
+
+        // Indices into paths of the paths whose hit has a material of the given kind
+        const uint32_t* bin_data(material_kind kind) const { return binned.data() + bin_begin[size_t(kind)]; }
+        size_t bin_size(material_kind kind) const {
+            return bin_begin[size_t(kind) + 1] - bin_begin[size_t(kind)];
+        }
+
+        template <typename Finish>
+        void compact(Finish finish) {
+            // Calls finish(path) on every path that ended and moves the others to the front.
+            size_t kept = 0;
+            for (size_t k = 0; k < paths.size(); k++) {
+                if (alive[k])
+                    paths[kept++] = paths[k];
+                else
+                    finish(paths[k]);
+            }
+            paths.resize(kept);
+        }
+
+    private:
+        std::vector<uint32_t> binned;
+        std::array<uint32_t, material_kind_count + 1> bin_begin{};
+};
+
+#endif
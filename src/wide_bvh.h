@@ -0,0 +1,311 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+template <int Width>
+struct alignas(64) wide_bvh_node {
+    /* Up to Width children, with their bounds stored axis by axis so that one vector load
+       fetches the same bound of several children. */
+    double   min_x[Width], min_y[Width], min_z[Width];
+    double   max_x[Width], max_y[Width], max_z[Width];
+    uint32_t child[Width];  // Interior child: node index. Leaf child: first entry of the primitives
+    uint16_t count[Width];  // Number of primitives of a leaf child, 0 for an interior child
+    uint8_t  size;          // Number of children in use
+
+    void set_bounds(int i, const aabb& box) {
+        min_x[i] = box.x.min;  max_x[i] = box.x.max;
+        min_y[i] = box.y.min;  max_y[i] = box.y.max;
+        min_z[i] = box.z.min;  max_z[i] = box.z.max;
+    }
+};
+
+template <int Width>
+class wide_bvh : public hittable {
+    /* A BVH with Width (4 or 8) children per node, made by collapsing the binary tree of a
+       bvh_tree build. Every node visit tests all of its children's boxes at once and then visits
+       the hit children nearest first. Leaves are the binary tree's leaves, so the primitives are
+       stored in the same leaf order as in linear_bvh. */
+    static_assert(Width >= 4 && Width <= 16, "wide_bvh supports 4 to 16 children per node");
+
+    public:
+        using node_type = wide_bvh_node<Width>;
+
+        wide_bvh(const hittable_list& list, const bvh_build_options& options = {})
+            : objects(list.objects)
+        {
+            std::vector<aabb> bounds;
+            bounds.reserve(objects.size());
+            for (const auto& object : objects)
+                bounds.push_back(object->bounding_box());
+
+            bvh_tree tree;
+            tree.build(bounds, options);
+            report = tree.build_report();
+            bbox = tree.bounding_box();
+
+            primitives.reserve(objects.size());
+            for (auto index : tree.indices)
+                primitives.push_back(objects[index].get());
+
+            if (!tree.nodes.empty()) {
+                nodes.reserve(tree.nodes.size() / (Width - 1) + 1);
+                collapse(tree, 0);
+            }
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (nodes.empty())
+                return false;
+
+            struct entry {
+                uint32_t index;  // Node index, or first primitive of a leaf
+                uint32_t count;  // Number of primitives of a leaf, 0 for a node
+                double   t;      // Distance at which the ray enters the box
+            };
+
+            entry stack[stack_size];
+            int stack_top = 0;
+            entry current = {0, 0, ray_t.min};
+            bool hit_anything = false;
+
+            while (true) {
+                if (current.count > 0) {
+                    for (uint32_t i = current.index; i < current.index + current.count; i++) {
+                        if (primitives[i]->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                } else {
+                    const auto& node = nodes[current.index];
+                    RT_COUNT(bvh_nodes_visited);
+
+                    double t_enter[Width];
+                    auto mask = intersect_children(node, r, ray_t, t_enter);
+
+                    if (mask) {
+                        // Order the hit children by entry distance, push all but the nearest
+                        // farthest first, and continue with the nearest right away.
+                        entry hits[Width];
+                        int hit_count = 0;
+                        for (; mask; mask &= mask - 1) {
+                            auto i = first_lane(mask);
+                            entry child = {node.child[i], node.count[i], t_enter[i]};
+
+                            int j = hit_count++;
+                            for (; j > 0 && hits[j-1].t < child.t; j--)
+                                hits[j] = hits[j-1];
+                            hits[j] = child;
+                        }
+
+                        for (int i = 0; i < hit_count - 1; i++)
+                            stack[stack_top++] = hits[i];
+                        current = hits[hit_count - 1];
+                        continue;
+                    }
+                }
+
+                // Skip entries that a closer hit, found since they were pushed, has culled.
+                do {
+                    if (stack_top == 0)
+                        return hit_anything;
+                    current = stack[--stack_top];
+                } while (current.t >= ray_t.max);
+            }
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        size_t node_count() const { return nodes.size(); }
+
+        const bvh_build_report& build_report() const { return report; }
+
+        double average_children() const {
+            // How well the nodes are filled, out of Width.
+            size_t children = 0;
+            for (const auto& node : nodes)
+                children += node.size;
+            return nodes.empty() ? 0 : double(children) / nodes.size();
+        }
+
+        size_t memory_bytes() const {
+            // Bytes used by the hierarchy itself, not counting the primitives.
+            return nodes.size() * sizeof(node_type) + primitives.size() * sizeof(const hittable*);
+        }
+
+        void print_layout(std::ostream& out) const {
+            out << "BVH" << Width << ": " << nodes.size() << " nodes of " << sizeof(node_type)
+                << " bytes, " << average_children() << " of " << Width << " children used, "
+                << memory_bytes() / 1024.0 << " KiB, "
+                << (primitives.empty() ? 0.0 : double(memory_bytes()) / primitives.size())
+                << " bytes per primitive\n";
+        }
+
+    private:
+        // Every node visit pops one entry and pushes at most Width, and the tree is no deeper
+        // than the binary tree it was collapsed from.
+        static const int stack_size = bvh_tree::max_depth * (Width - 1) + 1;
+
+        std::vector<node_type> nodes;
+        std::vector<const hittable*> primitives;  // In leaf order, indexed by leaf ranges
+        std::vector<shared_ptr<hittable>> objects;
+        bvh_build_report report;
+        aabb bbox;
+
+        uint32_t collapse(const bvh_tree& tree, uint32_t binary_root) {
+            /* Creates the wide node for the binary subtree below binary_root. Its children start
+               as the root's two children; the interior child with the largest surface area is
+               then replaced by its own two children until the node is full or only leaves are
+               left. Returns the index of the new node. */
+            uint32_t children[Width];
+            int size = 0;
+
+            const auto& root = tree.nodes[binary_root];
+            if (root.is_leaf()) {
+                children[size++] = binary_root;
+            } else {
+                children[size++] = binary_root + 1;
+                children[size++] = root.offset;
+            }
+
+            while (size < Width) {
+                int widest = -1;
+                double widest_area = -1;
+                for (int i = 0; i < size; i++) {
+                    const auto& child = tree.nodes[children[i]];
+                    if (!child.is_leaf() && child.bbox.surface_area() > widest_area) {
+                        widest = i;
+                        widest_area = child.bbox.surface_area();
+                    }
+                }
+                if (widest < 0)
+                    break;
+
+                auto expanded = children[widest];
+                children[widest] = expanded + 1;
+                children[size++] = tree.nodes[expanded].offset;
+            }
+
+            auto index = uint32_t(nodes.size());
+            nodes.emplace_back();
+
+            for (int i = 0; i < size; i++) {
+                const auto& child = tree.nodes[children[i]];
+                uint32_t target = child.offset;
+                if (!child.is_leaf())
+                    target = collapse(tree, children[i]);
+
+                // Written after the recursion, which may have reallocated the node array.
+                auto& node = nodes[index];
+                node.set_bounds(i, child.bbox);
+                node.child[i] = target;
+                node.count[i] = child.count;
+            }
+
+            auto& node = nodes[index];
+            node.size = uint8_t(size);
+            for (int i = size; i < Width; i++) {
+                node.set_bounds(i, aabb::empty);
+                node.child[i] = 0;
+                node.count[i] = 0;
+            }
+
+            return index;
+        }
+
+        static uint32_t intersect_children(
+            const node_type& node, const ray& r, const interval& ray_t, double* t_enter
+        ) {
+            /* Slab test of the ray against every child box, with the same open bounds as
+               aabb::hit. The ray's sign bits select the near and far planes per axis, so each
+               axis costs two subtractions and two multiplications per child. Children are
+               tested four at a time with AVX, two at a time with SSE2, one at a time otherwise.
+               Returns the mask of hit children and their entry distances in t_enter.
+
+               The slab distance is the first operand of max/min, which return the second one if
+               either is NaN: an origin on a slab plane of an axis the ray is parallel to (0 * inf)
+               then leaves that axis unconstrained, as with std::fmax. */
+            const auto& orig = r.origin();
+            const auto& inv  = r.inv_direction();
+
+            const double* near_x = r.dir_is_neg(0) ? node.max_x : node.min_x;
+            const double* far_x  = r.dir_is_neg(0) ? node.min_x : node.max_x;
+            const double* near_y = r.dir_is_neg(1) ? node.max_y : node.min_y;
+            const double* far_y  = r.dir_is_neg(1) ? node.min_y : node.max_y;
+            const double* near_z = r.dir_is_neg(2) ? node.max_z : node.min_z;
+            const double* far_z  = r.dir_is_neg(2) ? node.min_z : node.max_z;
+
+            uint32_t mask = 0;
+
+#if defined(__AVX__)
+            const int step = 4;
+            auto ox = _mm256_set1_pd(orig.x()), oy = _mm256_set1_pd(orig.y()), oz = _mm256_set1_pd(orig.z());
+            auto ix = _mm256_set1_pd(inv.x()),  iy = _mm256_set1_pd(inv.y()),  iz = _mm256_set1_pd(inv.z());
+
+            for (int g = 0; g < Width; g += step) {
+                auto enter = _mm256_set1_pd(ray_t.min);
+                auto exit  = _mm256_set1_pd(ray_t.max);
+
+                enter = _mm256_max_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(near_x + g), ox), ix), enter);
+                exit  = _mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(far_x + g),  ox), ix), exit);
+                enter = _mm256_max_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(near_y + g), oy), iy), enter);
+                exit  = _mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(far_y + g),  oy), iy), exit);
+                enter = _mm256_max_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(near_z + g), oz), iz), enter);
+                exit  = _mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(far_z + g),  oz), iz), exit);
+
+                _mm256_storeu_pd(t_enter + g, enter);
+                mask |= uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(enter, exit, _CMP_LT_OQ))) << g;
+            }
+#elif defined(__SSE2__)
+            const int step = 2;
+            auto ox = _mm_set1_pd(orig.x()), oy = _mm_set1_pd(orig.y()), oz = _mm_set1_pd(orig.z());
+            auto ix = _mm_set1_pd(inv.x()),  iy = _mm_set1_pd(inv.y()),  iz = _mm_set1_pd(inv.z());
+
+            for (int g = 0; g < Width; g += step) {
+                auto enter = _mm_set1_pd(ray_t.min);
+                auto exit  = _mm_set1_pd(ray_t.max);
+
+                enter = _mm_max_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(near_x + g), ox), ix), enter);
+                exit  = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(far_x + g),  ox), ix), exit);
+                enter = _mm_max_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(near_y + g), oy), iy), enter);
+                exit  = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(far_y + g),  oy), iy), exit);
+                enter = _mm_max_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(near_z + g), oz), iz), enter);
+                exit  = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(far_z + g),  oz), iz), exit);
+
+                _mm_storeu_pd(t_enter + g, enter);
+                mask |= uint32_t(_mm_movemask_pd(_mm_cmplt_pd(enter, exit))) << g;
+            }
+#else
+            const int step = 1;
+            for (int i = 0; i < Width; i++) {
+                auto enter = std::fmax(ray_t.min, std::fmax((near_x[i] - orig.x()) * inv.x(),
+                             std::fmax((near_y[i] - orig.y()) * inv.y(), (near_z[i] - orig.z()) * inv.z())));
+                auto exit  = std::fmin(ray_t.max, std::fmin((far_x[i] - orig.x()) * inv.x(),
+                             std::fmin((far_y[i] - orig.y()) * inv.y(), (far_z[i] - orig.z()) * inv.z())));
+                t_enter[i] = enter;
+                if (enter < exit)
+                    mask |= 1u << i;
+            }
+#endif
+            static_assert(Width % step == 0, "Width must be a multiple of the vector width");
+
+            return mask & ((1u << node.size) - 1);
+        }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif